@@ -0,0 +1,20 @@
+#include <cstdlib>
+#include <new>
+
+// Counting allocator hook: every operator new in the process bumps this, so
+// each benchmark can report heap allocations per iteration. Kept in its own
+// translation unit so the compiler can't pair inlined new/delete calls.
+size_t allocationCount = 0;
+
+void *operator new(size_t n) {
+  allocationCount++;
+  void *p = malloc(n ? n : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
@@ -0,0 +1,218 @@
+#include "homie.hpp"
+#include <benchmark/benchmark.h>
+
+/** Heap allocations so far, see alloc_count.cpp */
+extern size_t allocationCount;
+
+/** Adds an allocs/op counter covering the benchmark loop */
+class AllocationCounter {
+  benchmark::State &state;
+  size_t start;
+
+public:
+  AllocationCounter(benchmark::State &s)
+      : state(s), start(allocationCount) {}
+  ~AllocationCounter() {
+    state.counters["allocs/op"] = benchmark::Counter(
+        (double)(allocationCount - start), benchmark::Counter::kAvgIterations);
+  }
+};
+
+class BenchDevice : public homie::Device {
+public:
+  size_t bytes = 0;
+  BenchDevice(std::string id = "benchdevice")
+      : homie::Device(id, "1.0", "BenchDevice") {}
+  int getRssi() override { return -58; }
+
+  void publish(homie::Message m) override {
+    bytes += m.topic.length() + m.payload.length();
+    benchmark::DoNotOptimize(bytes);
+  }
+};
+
+/** A device with nodes x props settable properties with trivial readers */
+static BenchDevice *makeTree(int nodes, int props) {
+  auto d = new BenchDevice();
+  for (int i = 0; i < nodes; i++) {
+    auto n = new homie::Node(d, "node" + std::to_string(i), "Node", "bench");
+    for (int j = 0; j < props; j++) {
+      auto p = new homie::Property(n, "prop" + std::to_string(j), "Prop",
+                                   homie::INTEGER, true,
+                                   []() { return std::string("42"); });
+      p->setWriterFunc([](std::string) {});
+    }
+  }
+  return d;
+}
+
+static void BM_Introduce(benchmark::State &state) {
+  auto d = makeTree(state.range(0), state.range(1));
+  {
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+      d->introduce();
+    }
+  }
+  state.counters["bytes/op"] = benchmark::Counter(
+      (double)d->bytes, benchmark::Counter::kAvgIterations);
+  delete d;
+}
+BENCHMARK(BM_Introduce)->ArgsProduct({{1, 8, 64}, {1, 8, 64}});
+
+static void BM_OnMessage(benchmark::State &state) {
+  int nodes = state.range(0), props = state.range(1);
+  auto d = makeTree(nodes, props);
+  std::vector<homie::Message> commands;
+  for (int i = 0; i < nodes; i++) {
+    for (int j = 0; j < props; j++) {
+      commands.push_back(homie::Message(d->getTopicBase() + "node" +
+                                            std::to_string(i) + "/prop" +
+                                            std::to_string(j) + "/set",
+                                        "7"));
+    }
+  }
+  size_t i = 0;
+  {
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+      d->onMessage(commands[i]);
+      if (++i == commands.size()) {
+        i = 0;
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  delete d;
+}
+BENCHMARK(BM_OnMessage)->ArgsProduct({{1, 64}, {1, 64}});
+
+static void BM_RegistryOnMessage(benchmark::State &state) {
+  size_t sent = 0;
+  homie::DeviceRegistry reg([&sent](const homie::Message &) { sent++; });
+  int count = state.range(0);
+  reg.reserve(count, count * 5);
+  std::vector<homie::Message> commands;
+  for (int i = 0; i < count; i++) {
+    auto d = new BenchDevice("dev" + std::to_string(i));
+    auto n = new homie::Node(d, "node", "Node", "bench");
+    auto p = new homie::Property(n, "prop", "Prop", homie::INTEGER, true,
+                                 []() { return std::string("42"); });
+    p->setWriterFunc([](std::string) {});
+    reg.add(d);
+    commands.push_back(homie::Message(p->getSubTopic(), "7"));
+  }
+  size_t i = 0;
+  {
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+      reg.onMessage(commands[i]);
+      if (++i == commands.size()) {
+        i = 0;
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RegistryOnMessage)->Arg(100)->Arg(10000);
+
+static void BM_PropertyPublish(benchmark::State &state) {
+  auto d = makeTree(1, 1);
+  auto p = d->getNode("node0")->getProperty("prop0");
+  {
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+      p->publish();
+    }
+  }
+  delete d;
+}
+BENCHMARK(BM_PropertyPublish);
+
+static void BM_SplitString(benchmark::State &state) {
+  std::string topic("homie/benchdevice/node0/prop0/set");
+  std::vector<std::string> parts;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    parts.clear();
+    homie::split_string(topic, "/", parts);
+    benchmark::DoNotOptimize(parts.data());
+  }
+}
+BENCHMARK(BM_SplitString);
+
+static void BM_FormatMac(benchmark::State &state) {
+  std::string mac("aabbccddeeff");
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(homie::formatMac(mac));
+  }
+}
+BENCHMARK(BM_FormatMac);
+
+static void BM_F2s(benchmark::State &state) {
+  float f = 21.4567f;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(homie::f2s(f));
+    f += 0.01f;
+  }
+}
+BENCHMARK(BM_F2s);
+
+/** Retained replay of many devices, as a controller sees it on connect */
+static void BM_DiscoveryReplay(benchmark::State &state) {
+  std::vector<homie::Message> replay;
+  for (int i = 0; i < state.range(0); i++) {
+    BenchDevice d("device" + std::to_string(i));
+    for (int n = 0; n < 4; n++) {
+      auto node = new homie::Node(&d, "node" + std::to_string(n), "Node", "x");
+      for (int j = 0; j < 8; j++) {
+        new homie::Property(node, "prop" + std::to_string(j), "Prop",
+                            homie::INTEGER, false,
+                            []() { return std::string("42"); });
+      }
+    }
+    homie::Introduction intro(&d);
+    homie::Message m;
+    while (intro.next(m)) {
+      replay.push_back(m);
+    }
+  }
+  homie::Discovery discovery;
+  for (auto &m : replay) {
+    discovery.onMessage(m);
+  }
+  {
+    AllocationCounter allocs(state);
+    size_t i = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(discovery.onMessage(replay[i]));
+      if (++i == replay.size()) {
+        i = 0;
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DiscoveryReplay)->Arg(1)->Arg(1000);
+
+static void BM_SubscriptionDispatch(benchmark::State &state) {
+  homie::SubscriptionTrie trie;
+  size_t calls = 0;
+  for (int i = 0; i < state.range(0); i++) {
+    trie.add("app/sensor" + std::to_string(i) + "/+/value",
+             [&calls](const homie::Message &) { calls++; });
+  }
+  trie.add("homie/$broadcast/#", [&calls](const homie::Message &) {});
+  homie::Message m("app/sensor7/kitchen/value", "1");
+  {
+    AllocationCounter allocs(state);
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(trie.dispatch(m));
+    }
+  }
+}
+BENCHMARK(BM_SubscriptionDispatch)->Arg(10)->Arg(10000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,51 @@
+#pragma once
+#include "all.hpp"
+
+/**
+ * Default size in bytes of the arena each Device places its nodes and
+ * properties in. 0 disables the arena; objects are then heap-allocated.
+ * Override at build time, e.g. -DHOMIE_ARENA_BYTES=8192.
+ */
+#ifndef HOMIE_ARENA_BYTES
+#define HOMIE_ARENA_BYTES 0
+#endif
+
+namespace homie {
+
+/**
+ * @brief Bump allocator over one contiguous block, reserved up front.
+ * Individual allocations are never freed; the whole block is released at
+ * once when the arena is destroyed. This keeps a long-lived object graph
+ * from fragmenting the heap.
+ */
+class Arena {
+private:
+  char *base;
+  size_t capacity;
+  size_t used;
+  size_t allocations;
+  /** requests that did not fit */
+  size_t overflows;
+
+public:
+  Arena(size_t bytes);
+  ~Arena();
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  /**
+   * @return aligned storage for size bytes, or nullptr if the arena is full
+   */
+  void *allocate(size_t size, size_t align);
+
+  bool owns(const void *p) {
+    return (const char *)p >= base && (const char *)p < base + capacity;
+  }
+
+  size_t getCapacity() { return capacity; }
+  size_t getUsed() { return used; }
+  size_t getFree() { return capacity - used; }
+  size_t getAllocations() { return allocations; }
+  size_t getOverflows() { return overflows; }
+};
+} // namespace homie
@@ -0,0 +1,85 @@
+#pragma once
+#include "all.hpp"
+#include "token_bucket.hpp"
+#include "value_format.hpp"
+
+namespace homie {
+
+/**
+ * @brief Limits how often commands reach a property's writer, see
+ * Property::setCommandPolicy. Deferred commands are coalesced so that only
+ * the latest one is written; Device::tick writes them when they fall due.
+ */
+struct CommandPolicy {
+  /** at least this many ms between writer calls, 0 = no minimum */
+  unsigned long minInterval;
+  /** write only once commands stop arriving for this many ms, 0 = at once */
+  unsigned long debounce;
+  /** writer calls per second, 0 = unlimited; commands beyond wait */
+  unsigned long maxRate;
+  /** writer calls allowed in a burst, 0 = one second's worth */
+  unsigned long burst;
+
+  CommandPolicy(unsigned long minInterval = 0, unsigned long debounce = 0,
+                unsigned long maxRate = 0, unsigned long burst = 0)
+      : minInterval(minInterval), debounce(debounce), maxRate(maxRate),
+        burst(burst) {}
+};
+
+/**
+ * @brief Applies a CommandPolicy to a stream of validated commands, keeping
+ * at most one deferred command.
+ */
+class CommandLimiter {
+public:
+  enum Action { WRITE, DEFER };
+
+private:
+  CommandPolicy policy;
+  TokenBucket bucket;
+  bool pending;
+  /** the pending command is waiting for a token, not for dueAt's interval */
+  bool throttled;
+  std::string payload;
+  CommandValue value;
+  unsigned long dueAt;
+  bool written;
+  unsigned long lastWrite;
+  unsigned long dropped;
+  unsigned long coalesced;
+
+  /** earliest time minInterval allows the next write */
+  unsigned long nextWrite(unsigned long now);
+  /**
+   * take a token for a write at now; without one, the pending command is
+   * throttled until the bucket refills
+   */
+  bool admit(unsigned long now);
+
+public:
+  CommandLimiter(const CommandPolicy &p);
+
+  const CommandPolicy &getPolicy() { return policy; }
+
+  /**
+   * @brief Decide what happens to a command arriving at now. WRITE means
+   * call the writer now; DEFER means it was kept (replacing any earlier
+   * deferred command) for poll().
+   */
+  Action offer(const std::string &payload, const CommandValue &v,
+               unsigned long now);
+
+  /**
+   * @brief Hand out the deferred command if it is due at now.
+   * @return true if p and v should be written now
+   */
+  bool poll(unsigned long now, std::string &p, CommandValue &v);
+
+  bool hasPending() { return pending; }
+
+  /** Commands replaced by a newer one while waiting for the rate limit */
+  unsigned long getDropped() { return dropped; }
+  /** Commands replaced by a newer one during a minInterval or debounce */
+  unsigned long getCoalesced() { return coalesced; }
+};
+} // namespace homie
@@ -1,11 +1,21 @@
 #pragma once
+#include "arena.hpp"
 #include "enum.hpp"
 #include "homie.hpp"
+#include "memory_report.hpp"
+#include "message_log.hpp"
+#include "mpsc_ring.hpp"
+#include "outbox.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
+#include "subscription_trie.hpp"
 
 namespace homie {
 class Node;
 class Property;
 class Message;
+class Outbox;
+class DeviceRegistry;
 
 /**
  * @brief  Models a homie device. A homie device has 0 or many nodes, and  has
@@ -27,21 +37,264 @@ protected:
   std::string topicBase;
   std::string homieTopicBase;
 
+  /** Optional storage for nodes and properties made with create() */
+  std::unique_ptr<Arena> arena;
+
   Node *wifiNode;
   Property *rssiProp;
   Property *wifiSignalProp;
   Property *localIpProp;
   Property *macProp;
-  std::vector<std::string> topicElements;
+
+  /** Inbound routing index: full command topic to the property it sets */
+  std::unordered_map<std::string, Property *> routes;
+  /** When hosted by a registry, it holds the routes and receives output */
+  DeviceRegistry *registry;
+
+  /** publish() directly, or via the registry sink */
+  void deliver(const Message &m);
+
+  /** onMessage() without the instrumentation */
+  void handleMessage(const Message &m);
+
+  /** Optional paced outbound queue, see enableOutbox() */
+  std::unique_ptr<Outbox> outbox;
+#ifdef HOMIE_THREADS
+  /** Optional hand-off from publishing threads, see enableConcurrentSend() */
+  std::unique_ptr<MpscRing<Outgoing>> concurrentOutbox;
+#endif
+
+  /** Periodic property samples, see Property::setSampleInterval */
+  Scheduler scheduler;
+  /** Properties due in the current tick, reused between ticks */
+  std::vector<Property *> dueBatch;
+#ifdef HOMIE_MMAP
+  /** Log of published and received messages, see setRecorder */
+  MessageLog *recorder;
+#endif
+  /** Handlers for topics other than property commands */
+  SubscriptionTrie subscriptions;
+  /** Bulk-read and snapshot nodes already handled in the current tick */
+  std::vector<Node *> sampledNodes;
+  /**
+   * Time passed to the latest tick(); atomic because threads publishing
+   * properties stamp them with it
+   */
+  std::atomic<unsigned long> lastTick;
+  /** Properties holding a deferred command, see Property::setCommandPolicy */
+  std::vector<Property *> pendingCommands;
+#ifdef HOMIE_THREADS
+  /** Properties with an asynchronous read outstanding */
+  std::vector<Property *> awaitingReads;
+#endif
+
+  /** Topology fingerprint last seen retained on the broker */
+  std::string publishedFingerprint;
+
+  /** Optional diagnostics node, see enableMemoryNode() */
+  Node *memoryNode;
+  MemoryReport lastMemoryReport;
+
+  /** Optional instrumentation, see enableStats() */
+  std::unique_ptr<DeviceStats> stats;
+  /** Optional diagnostics node, see enableStatsNode() */
+  Node *statsNode;
+  unsigned long statsInterval;
+  /** time of the last publishStats() and the counts it published */
+  unsigned long lastStatsAt;
+  unsigned long lastStatsPublished;
+  unsigned long lastStatsBytes;
+  /** messages per second between the last two publishStats() */
+  float publishRate;
 
 public:
+  /**
+   * @param arenaBytes size of the arena that create() places nodes and
+   * properties in; 0 to allocate them individually on the heap
+   */
   Device(std::string aid, std::string aVersion, std::string aname,
-         std::string homieTopicBase = "homie");
+         std::string homieTopicBase = "homie",
+         size_t arenaBytes = HOMIE_ARENA_BYTES);
   virtual ~Device();
 
+  /**
+   * @brief Construct a Node, Property or TypedProperty in the device arena,
+   * falling back to the heap when there is no arena or it is full. The
+   * device owns the result and frees it with destroy().
+   *
+   * <pre>
+auto n = device->create<homie::Node>(device, "env", "Environment", "bme280");
+device->create<homie::Property>(n, "temp", "Temperature", homie::FLOAT,
+                                false, readTemp);
+   * </pre>
+   */
+  template <typename T, typename... Args> T *create(Args &&...args) {
+    void *mem = arena ? arena->allocate(sizeof(T), alignof(T)) : nullptr;
+    if (mem) {
+      return new (mem) T(std::forward<Args>(args)...);
+    }
+    return new T(std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Destroy an object made with create() or plain new. Arena storage
+   * is reclaimed all at once when the device goes away.
+   */
+  template <typename T> void destroy(T *p) {
+    if (arena && arena->owns(p)) {
+      p->~T();
+    } else {
+      delete p;
+    }
+  }
+
+  /** The device arena, or nullptr if it was created without one */
+  Arena *getArena() { return arena.get(); }
+
   virtual void publish(Message);
+
+  /**
+   * @brief Hand a message to the outbound path. Everything the library
+   * emits goes through here: when an outbox is enabled the message is queued
+   * for pump(), otherwise it is passed straight to publish().
+   *
+   * @param source the property whose retained value m carries, if any; a
+   * coalescing outbox keeps only its newest unsent value
+   */
+  void send(const Message &m, const Property *source = nullptr);
+
+  /**
+   * @brief Queue outbound messages in a fixed-capacity ring instead of
+   * publishing them immediately, and drain them with pump() at no more than
+   * the given rates. A rate of 0 means unlimited.
+   *
+   * @param coalesce replace a property's queued, unsent value with its
+   * newer one instead of queueing both, so the queue is bounded by the
+   * number of properties rather than their update rate. Introductions and
+   * other messages keep their order.
+   */
+  void enableOutbox(size_t capacity, unsigned long messagesPerSec = 0,
+                    unsigned long bytesPerSec = 0, bool coalesce = false);
+  Outbox *getOutbox() { return outbox.get(); }
+
+#ifdef HOMIE_THREADS
+  /**
+   * @brief Let any thread publish. From now on send() only pushes messages
+   * into a lock-free ring of the given capacity, and the single network
+   * thread hands them to the outbox or publish() in drain(), pump() or
+   * tick(). Messages are dropped and counted when the ring is full.
+   *
+   * Property values are not locked: publish a given property from one
+   * thread at a time, and keep settable properties on the network thread.
+   * Call this before other threads start publishing.
+   */
+  void enableConcurrentSend(size_t capacity);
+  MpscRing<Outgoing> *getConcurrentOutbox() { return concurrentOutbox.get(); }
+
+  /**
+   * @brief Network thread only: forward everything other threads have
+   * queued.
+   * @return the number of messages forwarded
+   */
+  size_t drain();
+#endif
+
+  /**
+   * @brief Publish queued messages for as long as the outbox rate budget
+   * allows. Call this from the main loop. In concurrent mode this first
+   * drain()s messages queued by other threads.
+   *
+   * @param now monotonic time in milliseconds
+   * @return the number of messages published
+   */
+  size_t pump(unsigned long now);
+
+  /**
+   * @brief Run periodic work from the main loop: sample and publish (if
+   * changed) every property whose sample interval is due, publish finished
+   * asynchronous reads, write deferred commands, then pump() the outbox.
+   *
+   * @param now monotonic time in milliseconds
+   * @return the number of properties sampled
+   */
+  size_t tick(unsigned long now);
+  Scheduler &getScheduler() { return scheduler; }
+  unsigned long getLastTick() {
+    return lastTick.load(std::memory_order_relaxed);
+  }
+
+  /** Called by Property::command to have tick() write a deferred command */
+  void awaitCommand(Property *p);
+
+  /**
+   * @brief Write deferred commands that fell due. Called by tick().
+   * @return the number of commands still deferred
+   */
+  size_t pollCommands(unsigned long now);
+
+#ifdef HOMIE_THREADS
+  /** Called by Property::startRead to have tick() poll the read */
+  void awaitRead(Property *p);
+
+  /**
+   * @brief Publish asynchronous reads that completed or timed out. Called by
+   * tick().
+   * @return the number of reads still outstanding
+   */
+  size_t pollReads(unsigned long now);
+#endif
   virtual void subscribe(std::string commandTopic);
-  void onMessage(Message);
+
+  /**
+   * @brief Have onMessage pass messages matching an MQTT filter (with + and
+   * # wildcards) to h, e.g. application topics or homie/$broadcast/#.
+   * @return false if filter isn't a valid MQTT topic filter
+   */
+  bool addSubscription(const std::string &filter, MessageHandler h);
+  SubscriptionTrie &getSubscriptions() { return subscriptions; }
+
+#ifdef HOMIE_MMAP
+  /**
+   * @brief Append every message this device publishes, and every message
+   * passed to onMessage, to log. Commands routed by a DeviceRegistry skip
+   * onMessage and aren't recorded. nullptr stops recording.
+   */
+  void setRecorder(MessageLog *log) { recorder = log; }
+  MessageLog *getRecorder() { return recorder; }
+#endif
+
+  /** Handle homie/$broadcast/# messages with h */
+  bool onBroadcast(MessageHandler h) {
+    return addSubscription(homieTopicBase + "/$broadcast/#", h);
+  }
+
+  /**
+   * @brief The smallest set of filters covering this device's command
+   * topics, its fingerprint topic and every addSubscription filter.
+   */
+  std::vector<std::string> getSubscriptionFilters();
+
+  /** subscribe() to each of getSubscriptionFilters() */
+  void subscribeAll();
+
+  /**
+   * @brief Handle an inbound message: commands go to the property routed to
+   * the topic, anything else to the matching addSubscription handlers.
+   */
+  void onMessage(const Message &m);
+
+  /**
+   * @brief Apply a command to a property already resolved from the topic,
+   * ignoring it unless the property is settable.
+   */
+  void dispatch(Property *prop, const Message &m);
+
+  /**
+   * @brief Called by DeviceRegistry::add. Hands this device's routes to the
+   * shared index and sends its output to the registry sink from now on.
+   */
+  void setRegistry(DeviceRegistry *r);
+  DeviceRegistry *getRegistry() { return registry; }
 
   std::string getId() { return id; }
 
@@ -54,6 +307,21 @@ public:
   std::string getTopicBase() { return topicBase; }
   void addNode(Node *n);
   Node *getNode(std::string nm);
+  const std::map<std::string, Node *> &getNodes() { return nodes; }
+
+  /**
+   * @brief Register a property's command topic in the inbound routing index.
+   * Called by Node::addProperty.
+   */
+  void addRoute(Property *p);
+
+  /**
+   * @brief Resolve a full command topic, e.g. homie/dev/node/prop/set, to its
+   * property with a single hash lookup.
+   *
+   * @return the property, or nullptr when nothing is routed to the topic
+   */
+  Property *findRoute(const std::string &topic);
 
   LifecycleState getLifecycleState() { return lifecycleState; }
   void setLifecycleState(LifecycleState lcs) { lifecycleState = lcs; }
@@ -63,6 +331,14 @@ public:
 
   void publishWifi();
 
+  /**
+   * @brief Publish RSSI and signal strength only when they have moved by
+   * more than a few units, or every five minutes otherwise.
+   *
+   * @param now monotonic time in milliseconds
+   */
+  void publishWifi(unsigned long now);
+
   /**
    * @brief  Ask the OS for IP address and MAC address.
    * Set the mac and localIp properties when found.
@@ -95,10 +371,91 @@ homie / device123 / mythermostat / temperature / $datatype → integer
 homie / device123 / mythermostat / temperature / $settable → true
    * </pre>
    *
+   * When the broker's retained $fingerprint matches getFingerprint() the
+   * metadata is skipped and only current property values and $state are sent.
+   * A full introduction ends with an updated $fingerprint.
+   *
    * @return a list of messages to perform a homie introduction
+   * @see Introduction to produce the same messages one at a time
    */
   void introduce();
 
+  /**
+   * @brief Produce the device-level introduction attribute at index step
+   * ($homie through $nodes) and advance step.
+   * @return false when all device attributes have been produced
+   */
+  bool nextIntroduction(unsigned &step, Message &out);
+
+  /**
+   * @brief Hash of everything the introduction publishes as retained
+   * metadata: device, node and property ids, names, types, datatypes, units,
+   * formats and settable/retained flags, plus the firmware version, local IP
+   * and MAC address.
+   */
+  std::string getFingerprint();
+
+  /**
+   * @brief Retained attribute holding the fingerprint of the last complete
+   * introduction. Subscribe to it before introducing so that Device::onMessage
+   * can pick up the retained value.
+   */
+  std::string getFingerprintTopic() { return topicBase + "$fingerprint"; }
+  std::string getPublishedFingerprint() { return publishedFingerprint; }
+
+  /**
+   * @brief Whether the broker already holds an introduction for the current
+   * topology. When true, introduce() sends only current values and $state.
+   */
+  bool isTopologyPublished();
+
+  /** Force the next introduction to be a full one */
+  void forgetFingerprint() { publishedFingerprint.clear(); }
+
+  /**
+   * @brief Walk the device tree and estimate the RAM it holds, broken down
+   * per node. See MemoryUsage for what is and isn't counted.
+   */
+  MemoryReport memoryReport();
+
+  /**
+   * @brief Add a built-in "memory" node whose retained properties carry the
+   * latest memory report: total, objects, strings, containers, functions and
+   * a per-node breakdown. Refresh it with publishMemory().
+   */
+  void enableMemoryNode();
+
+  /** Take a fresh memory report and publish it on the memory node */
+  void publishMemory();
+
+  /**
+   * @brief Monotonic microseconds used to time reads, dispatch and
+   * introductions. Defaults to std::chrono::steady_clock; override it with
+   * the platform's uptime clock if that is cheaper. WorkerPool reads are
+   * timed with std::chrono::steady_clock instead.
+   */
+  virtual uint64_t getMicros();
+
+  /**
+   * @brief Start counting published and received messages and timing
+   * property reads, onMessage and introduce() in log2 histograms, see
+   * DeviceStats and Property::getReadLatency. Recording doesn't allocate.
+   */
+  void enableStats();
+  /** nullptr unless enableStats() was called */
+  DeviceStats *getStats() { return stats.get(); }
+
+  /**
+   * @brief Enable stats and add a built-in "stats" node carrying them:
+   * published, bytes, received, rate (messages/sec), read-p99,
+   * dispatch-p99 and introduce-max (microseconds). tick() publishes it
+   * every interval ms; with 0 only publishStats() does.
+   */
+  void enableStatsNode(unsigned long interval = 0);
+
+  /** Publish the stats node, computing the rate since the previous call */
+  void publishStats(unsigned long now);
+
   std::string getLifecycleTopic();
   Message getLwt();
   Message getLifecycleMsg();
@@ -0,0 +1,80 @@
+#pragma once
+#include "all.hpp"
+#include "introduction.hpp"
+
+namespace homie {
+class Device;
+class Message;
+class Property;
+
+/**
+ * @brief Hosts many devices behind one connection, e.g. a bridge that
+ * models each downstream sensor as its own homie Device.
+ *
+ * The registry owns its devices. All of their command topics live in one
+ * shared routing index, so an inbound message is resolved with a single
+ * hash lookup however many devices there are, and a device keeps no index
+ * of its own. Everything the devices send goes to one shared sink.
+ * Introductions are queued and produced a few messages at a time by
+ * introduceSome(), so only one introduction cursor exists at any time.
+ */
+class DeviceRegistry {
+private:
+  std::unordered_map<std::string, Device *> devices;
+  std::unordered_map<std::string, Property *> routes;
+  std::function<void(const Message &)> sink;
+
+  /** devices waiting to be introduced, oldest first */
+  std::vector<Device *> introductionQueue;
+  size_t introductionHead;
+  std::unique_ptr<Introduction> introduction;
+
+public:
+  DeviceRegistry(std::function<void(const Message &)> sink);
+  ~DeviceRegistry();
+  DeviceRegistry(const DeviceRegistry &) = delete;
+  DeviceRegistry &operator=(const DeviceRegistry &) = delete;
+
+  /** Pre-size the tables for the expected number of devices and properties */
+  void reserve(size_t deviceCount, size_t propertyCount);
+
+  /**
+   * @brief Take ownership of a device, move its command topics into the
+   * shared index and queue its introduction.
+   * @return false, leaving d untouched, if a device with the same id exists
+   */
+  bool add(Device *d);
+
+  /** Remove and delete a device */
+  void remove(const std::string &id);
+
+  Device *getDevice(const std::string &id);
+  size_t size() { return devices.size(); }
+
+  void addRoute(Property *p);
+  Property *findRoute(const std::string &topic);
+  size_t routeCount() { return routes.size(); }
+
+  /**
+   * @brief Route an inbound message to the property it sets, or failing
+   * that to the device named in its topic.
+   */
+  void onMessage(const Message &m);
+
+  /** Deliver a message to the shared sink */
+  void publish(const Message &m) { sink(m); }
+
+  /** Queue every device for (re-)introduction, e.g. after reconnecting */
+  void introduceAll();
+
+  /**
+   * @brief Send up to max queued introduction messages.
+   * @return the number sent; 0 when nothing is left to introduce
+   */
+  size_t introduceSome(size_t max);
+
+  bool isIntroducing() {
+    return introduction || introductionHead < introductionQueue.size();
+  }
+};
+} // namespace homie
@@ -0,0 +1,104 @@
+#pragma once
+#include "all.hpp"
+
+namespace homie {
+class Message;
+
+/** What a controller knows about a remote property */
+struct PropertyMirror {
+  std::string id;
+  std::string name;
+  std::string datatype;
+  std::string unit;
+  std::string format;
+  std::string value;
+  bool settable;
+  bool retained;
+
+  PropertyMirror() : settable(false), retained(true) {}
+};
+
+/** What a controller knows about a remote node */
+struct NodeMirror {
+  std::string id;
+  std::string name;
+  std::string type;
+  /** ids listed in $properties, in the order given */
+  std::vector<std::string> propertyIds;
+  /** every property seen so far, listed or not */
+  std::unordered_map<std::string, PropertyMirror> properties;
+
+  PropertyMirror *getProperty(const std::string &id);
+};
+
+/** What a controller knows about a remote device */
+struct DeviceMirror {
+  std::string id;
+  std::string homie;
+  std::string name;
+  std::string state;
+  std::string implementation;
+  std::string localIp;
+  std::string mac;
+  std::string fwName;
+  std::string fwVersion;
+  std::vector<std::string> extensions;
+  /** ids listed in $nodes, in the order given */
+  std::vector<std::string> nodeIds;
+  /** every node seen so far, listed or not */
+  std::unordered_map<std::string, NodeMirror> nodes;
+
+  NodeMirror *getNode(const std::string &id);
+
+  /**
+   * @brief Whether every listed node and property has been described:
+   * $homie, $name, $nodes, each node's $name, $type and $properties and
+   * each listed property's $name and $datatype.
+   */
+  bool isComplete();
+};
+
+/**
+ * @brief Controller-side model of the homie devices below a topic base,
+ * rebuilt from a stream of messages such as a retained `homie/#` replay.
+ *
+ * Messages may arrive in any order: mirrors are created by the first
+ * attribute or value that applies to them and filled in as the rest
+ * arrive; /set echoes and unknown attributes create nothing. Each message
+ * is parsed in place and costs a few hash lookups; nothing is re-scanned,
+ * and the lookup keys reuse one buffer so that steady-state updates of
+ * known properties don't allocate.
+ */
+class Discovery {
+private:
+  std::string base;
+  std::unordered_map<std::string, DeviceMirror> devices;
+  /** scratch key for lookups */
+  std::string key;
+  size_t ignored;
+
+  DeviceMirror &deviceAt(const std::string &topic, size_t pos, size_t len);
+  /** Apply attribute attr, an index into the table of known attributes */
+  void deviceAttribute(DeviceMirror &d, int attr, const std::string &payload);
+  void nodeAttribute(NodeMirror &n, int attr, const std::string &payload);
+  void propertyAttribute(PropertyMirror &p, int attr,
+                         const std::string &payload);
+
+public:
+  Discovery(std::string homieTopicBase = "homie");
+
+  /**
+   * @brief Apply one message to the model.
+   * @return false if it isn't a homie attribute or value below the base
+   */
+  bool onMessage(const Message &m);
+
+  DeviceMirror *getDevice(const std::string &id);
+  const std::unordered_map<std::string, DeviceMirror> &getDevices() {
+    return devices;
+  }
+  size_t size() { return devices.size(); }
+  /** Messages that onMessage did not apply */
+  size_t getIgnored() { return ignored; }
+};
+} // namespace homie
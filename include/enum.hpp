@@ -1,4 +1,5 @@
 #pragma once
+#include "version.hpp"
 #include <string>
 
 namespace homie {
@@ -12,6 +13,22 @@ extern const std::string NODE_NM_WIFI;
 extern const std::string PROP_NM_RSSI;
 extern const std::string PROP_NM_WIFI_SIGNAL;
 
+// Literals shared by the runtime strings below and the compile-time
+// introduction in static_schema.hpp, so that the two cannot drift apart
+
+/** $homie: the convention version implemented */
+constexpr char SPEC_VERSION[] = "4.0";
+/** $implementation */
+constexpr char IMPLEMENTATION[] = "cslhomie-" HOMIE_LIB_VERSION;
+/** Listed first in every device's $extensions */
+constexpr char LEGACY_FIRMWARE_EXTENSION[] =
+    "org.homie.legacy-firmware:0.1.1:[4.x]";
+/** $datatype payloads, indexed by DataType */
+constexpr const char *DATA_TYPE_NAMES[] = {
+    "integer", "string", "float",    "percent", "boolean",
+    "enum",    "color",  "datetime", "duration"};
+
+/** DATA_TYPE_NAMES as strings */
 extern std::string DATA_TYPES[];
 extern std::string LIFECYCLE_STATES[];
 
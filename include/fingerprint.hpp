@@ -0,0 +1,32 @@
+#pragma once
+#include "all.hpp"
+
+namespace homie {
+
+/**
+ * @brief Incremental hash used to fingerprint a device's topology.
+ * Uses SHA-512 from mbedtls when available, otherwise 64-bit FNV-1a.
+ * Either way the result is rendered as 16 lowercase hex digits.
+ *
+ */
+class Fingerprint {
+private:
+#ifndef NO_MBEDTLS
+  mbedtls_sha512_context ctx;
+#else
+  uint64_t hash;
+#endif
+
+public:
+  Fingerprint();
+  ~Fingerprint();
+
+  void update(const char *data, size_t len);
+  /** Add a field, terminated so that adjacent fields can't run together */
+  void update(const std::string &s);
+  void update(bool b);
+
+  /** Finish hashing and return the digest as hex */
+  std::string hex();
+};
+} // namespace homie
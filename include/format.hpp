@@ -0,0 +1,34 @@
+#pragma once
+#include "all.hpp"
+
+namespace homie {
+
+/*
+ * Allocation-free value formatting for the publish path. Each function
+ * writes a NUL-terminated string into buf and returns its length, or 0 if
+ * buf is too small (buf then holds an empty string when len > 0).
+ */
+
+size_t formatInt(int32_t v, char *buf, size_t len);
+
+/**
+ * @brief Fixed-point decimal rendering of v with the given number of
+ * decimals (0-9), rounded half away from zero. NaN and infinities render as
+ * "nan", "inf" and "-inf".
+ */
+size_t formatFloat(float v, int decimals, char *buf, size_t len);
+
+size_t formatBool(bool v, char *buf, size_t len);
+
+/**
+ * @brief Copy the index'th entry of a comma-separated list, e.g. a homie
+ * enum $format, into buf.
+ */
+size_t formatEnum(unsigned index, const std::string &list, char *buf,
+                  size_t len);
+
+/**
+ * @brief Position of value in a comma-separated list, or -1 if absent.
+ */
+int enumIndexOf(const std::string &value, const std::string &list);
+} // namespace homie
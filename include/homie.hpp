@@ -1,15 +1,39 @@
 #pragma once
 #include "all.hpp"
+#include "arena.hpp"
+#include "command_policy.hpp"
 #include "device.hpp"
+#include "device_registry.hpp"
+#include "discovery.hpp"
 #include "enum.hpp"
+#include "fingerprint.hpp"
+#include "format.hpp"
+#include "introduction.hpp"
+#include "memory_report.hpp"
 #include "message.hpp"
+#include "message_log.hpp"
+#include "mpsc_ring.hpp"
+#include "mqtt_frame.hpp"
 #include "node.hpp"
+#include "outbox.hpp"
 #include "property.hpp"
+#include "property_value.hpp"
+#include "scheduler.hpp"
+#include "snapshot.hpp"
+#include "static_schema.hpp"
+#include "stats.hpp"
+#include "string_table.hpp"
+#include "subscription_trie.hpp"
+#include "token_bucket.hpp"
+#include "typed_property.hpp"
+#include "value_format.hpp"
+#include "worker_pool.hpp"
 #include <vector>
 
 namespace homie {
 
 std::string to_string(bool v);
+std::string to_string(int v);
 
 template <typename T> std::string to_string(const T &t) {
   std::ostringstream stm;
@@ -0,0 +1,69 @@
+#pragma once
+#include "all.hpp"
+
+namespace homie {
+class Device;
+class Node;
+class Property;
+class Message;
+
+/**
+ * @brief Pull-based homie introduction of a device. Yields the same ordered
+ * messages as Device::introduce, one per call to next(), so the caller can
+ * stop whenever its transport is busy and resume later. Only a small cursor
+ * is kept between calls; nothing is built ahead of time.
+ *
+ * <pre>
+homie::Introduction intro(device);
+homie::Message m;
+while (mqttCanSend() && intro.next(m)) {
+  mqttPublish(m);
+}
+ * </pre>
+ *
+ * If the broker's retained fingerprint matches the device topology (see
+ * Device::isTopologyPublished) only property values and the final $state are
+ * produced.
+ *
+ * Nodes or properties added while an introduction is in progress are picked
+ * up if the cursor has not yet passed them.
+ */
+class Introduction {
+private:
+  enum Phase {
+    DEVICE_ATTRS,
+    NODE_ATTRS,
+    PROPERTY_ATTRS,
+    FINGERPRINT,
+    FINISH,
+    DONE
+  };
+
+  Device *device;
+  Phase phase;
+  /** attribute index within the current device, node or property */
+  unsigned step;
+  std::map<std::string, Node *>::const_iterator nodeIt;
+  std::map<std::string, Property *>::const_iterator propIt;
+  /** broker already has this topology: send values and $state only */
+  bool valuesOnly;
+
+  void enterNode();
+
+public:
+  Introduction(Device *d);
+
+  /**
+   * @brief Produce the next introduction message.
+   * @return false once the introduction is complete
+   */
+  bool next(Message &out);
+
+  Device *getDevice() { return device; }
+  bool isDone() { return phase == DONE; }
+  bool isValuesOnly() { return valuesOnly; }
+
+  /** Start over from the first message, re-checking the fingerprint */
+  void restart();
+};
+} // namespace homie
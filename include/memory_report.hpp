@@ -0,0 +1,59 @@
+#pragma once
+#include "all.hpp"
+
+namespace homie {
+
+/**
+ * @brief Estimated bytes held by part of a device tree, by kind.
+ *
+ * String bytes are only counted once a string outgrows its inline buffer.
+ * Container bytes estimate the per-entry node overhead of the standard maps
+ * (links plus the stored key/value) and hash-table bucket arrays. Function
+ * bytes are the std::function objects themselves; a target too large for
+ * the inline buffer lives on the heap out of view and is not counted.
+ */
+struct MemoryUsage {
+  size_t objects;
+  size_t strings;
+  size_t containers;
+  size_t functions;
+
+  MemoryUsage() : objects(0), strings(0), containers(0), functions(0) {}
+  size_t total() const { return objects + strings + containers + functions; }
+  MemoryUsage &operator+=(const MemoryUsage &o);
+};
+
+struct NodeMemory {
+  std::string id;
+  size_t propertyCount;
+  /** the node, its property map and all of its properties */
+  MemoryUsage usage;
+};
+
+/**
+ * @brief Footprint of a whole Device, see Device::memoryReport.
+ */
+struct MemoryReport {
+  /** the Device object and its own tables, queues and arena slack */
+  MemoryUsage device;
+  std::vector<NodeMemory> nodes;
+  /** device plus all nodes */
+  MemoryUsage total;
+  /**
+   * the StringTable, shared by all devices and so not part of total; a
+   * string a device interns only appears here
+   */
+  MemoryUsage sharedStrings;
+};
+
+/** Heap bytes owned by s, 0 while it fits the small-string buffer */
+size_t heapBytes(const std::string &s);
+
+/** Estimated size of one std::map node holding a value_type of n bytes */
+inline size_t mapNodeBytes(size_t n) { return 4 * sizeof(void *) + n; }
+
+/** Estimated size of one std::unordered_map node holding n bytes */
+inline size_t hashNodeBytes(size_t n) {
+  return sizeof(void *) + sizeof(size_t) + n;
+}
+} // namespace homie
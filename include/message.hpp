@@ -9,6 +9,7 @@ public:
   std::string payload;
   int qos;
   bool retained;
+  Message();
   Message(std::string topic, std::string payload, bool retained = true,
           int qos = 1);
 };
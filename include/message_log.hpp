@@ -0,0 +1,100 @@
+#pragma once
+#include "all.hpp"
+#include "message.hpp"
+#ifdef HOMIE_MMAP
+#include <chrono>
+
+namespace homie {
+class Device;
+
+enum LogDirection { LOG_PUBLISHED = 0, LOG_RECEIVED };
+
+/** One entry of a MessageLog */
+struct LogRecord {
+  /** milliseconds since the log was started */
+  unsigned long time;
+  LogDirection direction;
+  Message message;
+};
+
+/**
+ * @brief Append-only binary log of the messages a device publishes and
+ * receives, written through a growing memory mapping. See
+ * Device::setRecorder and MessageLogReader.
+ *
+ * A record is a flags byte (always with bit 7 set: direction, qos,
+ * retained), then the milliseconds since the previous record, the topic
+ * length, the topic, the payload length and the payload, lengths and times
+ * as LEB128 varints. The unused tail of the mapping is zero and the flags
+ * byte is stored last, so a log cut short by a crash of the process ends
+ * cleanly at the last complete record. The mapping is never msync()ed, so
+ * there is no such guarantee if the machine loses power.
+ */
+class MessageLog {
+private:
+  int fd;
+  char *map;
+  size_t mapped;
+  size_t used;
+  unsigned long lastTime;
+  std::chrono::steady_clock::time_point started;
+
+  bool reserve(size_t more);
+
+public:
+  MessageLog();
+  /** Calls close() */
+  ~MessageLog();
+  MessageLog(const MessageLog &) = delete;
+  MessageLog &operator=(const MessageLog &) = delete;
+
+  /** Create or truncate path and start logging to it */
+  bool open(const std::string &path);
+  bool isOpen() { return map != nullptr; }
+
+  /** Append a message stamped with the time since open() */
+  bool append(LogDirection direction, const Message &m);
+  /** Append a message stamped with now (ms, not before the last record) */
+  bool append(unsigned long now, LogDirection direction, const Message &m);
+
+  /** Trim the file to the records written and unmap it */
+  void close();
+  /** Bytes of log written so far */
+  size_t size() { return used; }
+};
+
+/** Reads a MessageLog back, through a read-only mapping */
+class MessageLogReader {
+private:
+  int fd;
+  const char *map;
+  size_t length;
+  size_t pos;
+  unsigned long time;
+
+public:
+  MessageLogReader();
+  ~MessageLogReader();
+  MessageLogReader(const MessageLogReader &) = delete;
+  MessageLogReader &operator=(const MessageLogReader &) = delete;
+
+  /** @return false if path can't be opened or isn't a message log */
+  bool open(const std::string &path);
+  void close();
+
+  /** Read the next record. @return false at the end of the log */
+  bool next(LogRecord &out);
+  void rewind();
+
+  /**
+   * @brief Stream the rest of the log: received messages go through
+   * d.onMessage, published ones to published (if set).
+   * @param speed 1 keeps the recorded pace, 2 twice as fast, 0 (default) as
+   * fast as possible
+   * @return the number of records replayed
+   */
+  size_t replay(Device &d, std::function<void(const Message &)> published,
+                double speed = 0);
+};
+} // namespace homie
+#endif
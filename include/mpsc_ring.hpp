@@ -0,0 +1,98 @@
+#pragma once
+#include "all.hpp"
+#include <atomic>
+
+namespace homie {
+
+/**
+ * @brief Bounded lock-free multi-producer/single-consumer queue.
+ *
+ * Any number of threads may push() concurrently; exactly one thread may
+ * pop(). Each slot carries a sequence number that tells producers whether
+ * it is free and the consumer whether it is filled, so neither side ever
+ * takes a lock or waits for the other (after D. Vyukov's bounded queue).
+ * Capacity is rounded up to a power of two and allocated once.
+ */
+template <typename T> class MpscRing {
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  std::atomic<size_t> tail;
+  /** only touched by the consumer */
+  size_t head;
+  std::atomic<unsigned long> dropped;
+
+public:
+  MpscRing(size_t capacity) : tail(0), head(0), dropped(0) {
+    size_t n = 1;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    cells.reset(new Cell[n]);
+    for (size_t i = 0; i < n; i++) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    mask = n - 1;
+  }
+  MpscRing(const MpscRing &) = delete;
+  MpscRing &operator=(const MpscRing &) = delete;
+
+  /**
+   * @brief Enqueue a copy of v. Safe from any thread.
+   * @return false, and count a drop, when the ring is full
+   */
+  bool push(const T &v) {
+    Cell *cell;
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = v;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Dequeue the oldest element into out. Consumer thread only.
+   * @return false when nothing is ready
+   */
+  bool pop(T &out) {
+    Cell *cell = &cells[head & mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(head + 1) < 0) {
+      return false;
+    }
+    out = std::move(cell->data);
+    cell->seq.store(head + mask + 1, std::memory_order_release);
+    head++;
+    return true;
+  }
+
+  size_t capacity() { return mask + 1; }
+
+  /** Number of queued elements; exact on the consumer thread */
+  size_t depth() { return tail.load(std::memory_order_relaxed) - head; }
+
+  unsigned long getDropped() {
+    return dropped.load(std::memory_order_relaxed);
+  }
+};
+} // namespace homie
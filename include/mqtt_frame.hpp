@@ -0,0 +1,70 @@
+#pragma once
+#include "all.hpp"
+#include "message.hpp"
+
+namespace homie {
+
+/**
+ * @brief Encodes MQTT 3.1.1 PUBLISH packets straight into a caller-owned
+ * buffer, so a transport can send homie messages without building its own
+ * copy of topic and payload. QoS 1 and 2 frames get the next packet id,
+ * counting from 1 and skipping 0 on wrap-around.
+ */
+class MqttEncoder {
+private:
+  uint16_t nextPacketId;
+
+public:
+  /** Largest "remaining length" the variable byte integer can express */
+  static const size_t MAX_REMAINING = 268435455;
+
+  MqttEncoder() : nextPacketId(1) {}
+
+  /**
+   * @brief Bytes needed for a PUBLISH of this topic and payload, or 0 if
+   * the topic or whole packet is too long for MQTT.
+   */
+  static size_t frameSize(size_t topicLen, size_t payloadLen, int qos);
+
+  /**
+   * @brief Write one PUBLISH frame to buf.
+   * @param packetId if not null, receives the id used (0 for QoS 0)
+   * @return bytes written, or 0 if it doesn't fit in len (no id is used up)
+   */
+  size_t encode(const char *topic, size_t topicLen, const char *payload,
+                size_t payloadLen, int qos, bool retained, char *buf,
+                size_t len, uint16_t *packetId = nullptr);
+  size_t encode(const Message &m, char *buf, size_t len,
+                uint16_t *packetId = nullptr);
+
+  uint16_t peekPacketId() { return nextPacketId; }
+};
+
+/**
+ * @brief Packs PUBLISH frames back to back into one buffer, so a batch of
+ * messages goes out with a single socket write.
+ */
+class MqttBatch {
+private:
+  MqttEncoder &encoder;
+  char *buf;
+  size_t capacity;
+  size_t used;
+  size_t frames;
+
+public:
+  MqttBatch(MqttEncoder &encoder, char *buf, size_t capacity)
+      : encoder(encoder), buf(buf), capacity(capacity), used(0), frames(0) {}
+
+  /** Append m, or return false if the buffer has no room left for it */
+  bool add(const Message &m, uint16_t *packetId = nullptr);
+
+  const char *data() { return buf; }
+  size_t size() { return used; }
+  size_t count() { return frames; }
+  void clear() {
+    used = 0;
+    frames = 0;
+  }
+};
+} // namespace homie
@@ -1,5 +1,6 @@
 #pragma once
 #include "homie.hpp"
+#include "snapshot.hpp"
 
 namespace homie {
 class Property;
@@ -21,6 +22,14 @@ private:
   std::string psk;
   std::string identity;
 
+  /** Reads all properties in one go, see setBulkReader */
+  std::function<void(Node *)> bulkReader;
+
+  SnapshotMode snapshotMode;
+  SnapshotEncoding snapshotEncoding;
+  /** reused for every snapshot of this node */
+  std::string snapshotBuffer;
+
 public:
   Node(Device *d, std::string id, std::string aname, std::string nodeType);
   virtual ~Node();
@@ -31,10 +40,67 @@ public:
   std::string getName() { return name; }
   std::string getType() { return type; }
 
-  std::string getTopicBase() { return topicBase; }
+  const std::string &getTopicBase() { return topicBase; }
 
   void addProperty(Property *p);
   Property *getProperty(std::string nm);
+  const std::map<std::string, Property *> &getProperties() {
+    return properties;
+  }
   void introduce();
+
+  /**
+   * @brief Read every property of this node with a single call, e.g. one bus
+   * transaction for a BME280's temperature, humidity and pressure. f is
+   * called once per publish cycle and should hand each property its value
+   * with Property::setSample. The properties' own readerFuncs are no longer
+   * called; publish(), introductions and Device::tick sample the node
+   * instead, and properties of one node with the same sample interval are
+   * scheduled together.
+   */
+  void setBulkReader(std::function<void(Node *)> f) { bulkReader = f; }
+  bool hasBulkReader() { return (bool)bulkReader; }
+
+  /** Run the bulk reader, if any, to refresh every property's sample */
+  void sample();
+
+  /** Sample once, then publish every property */
+  void publish(int qos = 1);
+
+  /**
+   * @brief Sample once, then publish the properties whose value changed
+   * under their publish policy.
+   * @return the number of messages sent
+   */
+  size_t publishIfChanged(unsigned long now, int qos = 1);
+
+  /**
+   * @brief Opt in to a whole-node snapshot: one message on
+   * <node>/$snapshot holding every property id and value, encoded as a JSON
+   * object or a CBOR map. With SNAPSHOT_ONLY, publish(), publishIfChanged()
+   * and Device::tick send the snapshot instead of per-property messages;
+   * introductions still describe each property.
+   */
+  void setSnapshot(SnapshotMode mode,
+                   SnapshotEncoding encoding = SNAPSHOT_JSON) {
+    snapshotMode = mode;
+    snapshotEncoding = encoding;
+  }
+  SnapshotMode getSnapshotMode() { return snapshotMode; }
+  std::string getSnapshotTopic() { return topicBase + "$snapshot"; }
+
+  /** Encode the properties' cached values, valid until the next call */
+  const std::string &encodeSnapshot();
+  void publishSnapshot(int qos = 1);
+
+  /** Estimated RAM held by this node, its property map and its properties */
+  MemoryUsage memoryUsage();
+
+  /**
+   * @brief Produce the node-level introduction attribute at index step
+   * ($name, $type, $properties) and advance step.
+   * @return false when all node attributes have been produced
+   */
+  bool nextIntroduction(unsigned &step, Message &out);
 };
 } // namespace homie
@@ -0,0 +1,74 @@
+#pragma once
+#include "memory_report.hpp"
+#include "message.hpp"
+#include "token_bucket.hpp"
+
+namespace homie {
+
+/** A message on its way out, with the coalescing key of Outbox::push */
+struct Outgoing {
+  Message message;
+  const void *key;
+  Outgoing() : key(nullptr) {}
+  Outgoing(const Message &m, const void *k) : message(m), key(k) {}
+};
+
+/**
+ * @brief Fixed-capacity FIFO of outbound messages, drained under a
+ * messages/sec and bytes/sec budget. Slots are allocated once up front;
+ * messages arriving while the ring is full are dropped and counted.
+ *
+ * With coalescing on, a message pushed with a key replaces the unsent
+ * message with the same key in place (last value wins), so a chatty
+ * property holds at most one slot. Messages without a key, such as
+ * introductions, are never replaced and keep their order.
+ */
+class Outbox {
+private:
+  std::vector<Message> ring;
+  /** coalescing key of each slot, nullptr for none */
+  std::vector<const void *> keys;
+  /** slot holding the unsent message of each key */
+  std::unordered_map<const void *, size_t> pending;
+  bool coalescing;
+  size_t head;
+  size_t count;
+  size_t highWater;
+  unsigned long dropped;
+  unsigned long sent;
+  unsigned long coalesced;
+
+  TokenBucket messageBudget;
+  TokenBucket byteBudget;
+
+public:
+  Outbox(size_t capacity, unsigned long messagesPerSec = 0,
+         unsigned long bytesPerSec = 0, bool coalescing = false);
+
+  /**
+   * @brief Append a message, or with coalescing on replace the unsent
+   * message pushed with the same non-null key.
+   * @return false, and count a drop, when the ring is full
+   */
+  bool push(const Message &m, const void *key = nullptr);
+
+  /**
+   * @brief Move the oldest message into out if the rate budget allows it at
+   * time now (milliseconds).
+   * @return false when empty or when the budget is exhausted
+   */
+  bool pop(unsigned long now, Message &out);
+
+  size_t depth() { return count; }
+  size_t capacity() { return ring.size(); }
+  size_t getHighWater() { return highWater; }
+  unsigned long getDropped() { return dropped; }
+  unsigned long getSent() { return sent; }
+  /** Messages that replaced an unsent one instead of taking a slot */
+  unsigned long getCoalesced() { return coalesced; }
+  bool isCoalescing() { return coalescing; }
+
+  /** Estimated bytes held by the ring and the queued messages */
+  MemoryUsage memoryUsage();
+};
+} // namespace homie
@@ -1,16 +1,61 @@
 #pragma once
+#include "command_policy.hpp"
 #include "homie.hpp"
+#include "property_value.hpp"
+#include "stats.hpp"
+#include "string_table.hpp"
+#include "value_format.hpp"
+#include "worker_pool.hpp"
 
 namespace homie {
+
+/**
+ * @brief Command path state, allocated only for settable properties so
+ * that read-only ones don't pay for it.
+ */
+struct CommandState {
+  /**
+   * @brief A function that accepts a string value and does something with
+   * the hardware in response. The parsed value is null when the payload
+   * doesn't match the format, which only happens through setValue.
+   */
+  std::function<void(const std::string &, const CommandValue *)> writer;
+  /** $datatype and $format compiled by Property::setFormat */
+  ValueFormat format;
+  /** commands refused by format */
+  unsigned long rejected;
+  /** set by Property::setCommandPolicy */
+  std::unique_ptr<CommandLimiter> limiter;
+
+  CommandState() : rejected(0) {}
+};
+
+/**
+ * @brief Decides when Property::publishIfChanged actually publishes.
+ * A value is published when it differs from the last published value or
+ * when the heartbeat interval has elapsed. For INTEGER, FLOAT and PERCENT
+ * properties, changes no larger than a deadband are treated as no change.
+ */
+struct PublishPolicy {
+  /** ignore numeric changes of this size or smaller */
+  float absoluteDeadband;
+  /** ignore numeric changes up to this fraction of the last value, e.g. 0.05 */
+  float relativeDeadband;
+  /** republish an unchanged value after this many ms, 0 = never */
+  unsigned long heartbeat;
+
+  PublishPolicy(float absoluteDeadband = 0, float relativeDeadband = 0,
+                unsigned long heartbeat = 0)
+      : absoluteDeadband(absoluteDeadband), relativeDeadband(relativeDeadband),
+        heartbeat(heartbeat) {}
+};
+
 class Property {
 private:
-  /** a function or lambda to provide values. */
-  std::string pubTopic;
-  std::string subTopic;
-  /** Required unique id of property */
-  std::string id;
+  /** Required unique id of property, interned like the other attributes */
+  InternedString id;
   /** Required friendly name of property */
-  std::string name;
+  InternedString name;
   /** Required data type of property */
   DataType dataType;
 
@@ -28,23 +73,62 @@ private:
 
 *
 */
-  std::string format;
+  InternedString format;
+  InternedString unit;
   bool settable;
   bool retained;
-  std::string unit;
-  std::string value;
+  PropertyValue value;
+  /** latest value from the node's bulk reader, see Node::setBulkReader */
+  PropertyValue sampled;
 
-  /**
-   * @brief A function that accepts a string value and does something with the
-   * hardware in response. Only called when settable==true.
-   *
-   */
-  std::function<void(std::string)> writerFunc;
-  bool hasWriterFunc;
+  /** only allocated for settable properties */
+  std::unique_ptr<CommandState> commands;
 
   /** Node owning this property */
   Node *node;
 
+  PublishPolicy policy;
+  /** whether value is what the broker last received */
+  bool valuePublished;
+  /** time of the last publication, see Device::getLastTick for publish() */
+  unsigned long lastPublished;
+  /** milliseconds between scheduled samples, 0 = not scheduled */
+  unsigned long sampleInterval;
+#ifdef HOMIE_THREADS
+  /** set when reads go through setAsyncReader */
+  std::shared_ptr<AsyncRead> asyncRead;
+#endif
+
+  /** read latency, see Device::enableStats */
+  std::unique_ptr<Log2Histogram> readLatency;
+
+  CommandLimiter *limiter() {
+    return commands ? commands->limiter.get() : nullptr;
+  }
+
+  /** store v and hand it to the writer */
+  void write(const std::string &v, const CommandValue *parsed);
+
+  /** node topic base + id + suffix, in a single allocation */
+  std::string topic(const char *suffix);
+
+  /** the current value from the bulk sample or readerFunc */
+  std::string readCurrent();
+
+  /** take v as the published value if the policy counts it as a change */
+  bool acceptValue(const std::string &v, unsigned long now);
+
+  /** publish v if the policy counts it as a change */
+  bool offerValue(const std::string &v, unsigned long now, int qos);
+
+  bool isNumeric() {
+    return dataType == INTEGER || dataType == FLOAT || dataType == PERCENT;
+  }
+
+protected:
+  /** Called with every accepted command that parsed, before the writer */
+  virtual void onCommand(const CommandValue &) {}
+
 public:
   Property(Node *anode, std::string id, std::string name, DataType dataType,
            bool settable, std::function<std::string(void)> readerFunc);
@@ -56,21 +140,71 @@ public:
    */
   std::function<std::string(void)> readerFunc;
 
-  std::string getId() { return id; }
-  std::string getName() { return name; }
+  std::string getId() { return *id; }
+  std::string getName() { return *name; }
+  DataType getDataType() { return dataType; }
   std::string getDataTypeString() { return DATA_TYPES[(int)dataType]; }
-  std::string getSubTopic() { return subTopic; }
-  std::string getPubTopic() { return pubTopic; }
+  /** The command topic, built from the node's topic base on each call */
+  std::string getSubTopic();
+  /** The value topic, built from the node's topic base on each call */
+  std::string getPubTopic();
 
-  std::string getValue() { return value; }
+  std::string getValue() { return value.str(); }
+  /** The stored value, to read without a copy, see PropertyValue::view */
+  const PropertyValue &getStoredValue() { return value; }
   void setValue(std::string v);
+  /** Settable properties only; the writer is never called otherwise */
   void setWriterFunc(std::function<void(std::string)>);
 
-  std::string getFormat() { return format; }
-  void setFormat(std::string f) { this->format = f; }
+  /**
+   * @brief Install a writer that receives commands already checked against
+   * the $datatype and $format and parsed, see CommandValue.
+   */
+  void setTypedWriter(std::function<void(const CommandValue &)> f);
+
+  /**
+   * @brief Handle a command payload from the /set topic. Payloads that don't
+   * match the $datatype and $format are counted and dropped before they
+   * reach the value or the writer. Valid ones then pass the command policy,
+   * timed by Device::getLastTick.
+   * @return false if the command was rejected, or the property isn't
+   * settable
+   */
+  bool command(const std::string &payload);
+
+  /** Commands that failed the format check, 0 unless settable */
+  unsigned long getRejectedCommands() {
+    return commands ? commands->rejected : 0;
+  }
 
-  std::string getUnit() { return unit; };
-  void setUnit(std::string s) { unit = s; };
+  /**
+   * @brief Pace writer calls for commands, e.g. from a dimmer slider that
+   * sends dozens per second. Deferred commands are written by Device::tick.
+   * A default CommandPolicy removes the limits. Settable properties only.
+   */
+  void setCommandPolicy(const CommandPolicy &p);
+
+  /**
+   * @brief Write the deferred command if it is due. Called by Device::tick.
+   * @return true once no command is deferred any more
+   */
+  bool pollCommand(unsigned long now);
+
+  /** Commands superseded while waiting for the policy's rate limit */
+  unsigned long getDroppedCommands() {
+    return limiter() ? limiter()->getDropped() : 0;
+  }
+  /** Commands superseded during the policy's interval or debounce */
+  unsigned long getCoalescedCommands() {
+    return limiter() ? limiter()->getCoalesced() : 0;
+  }
+
+  const std::string &getFormat() { return *format; }
+  /** Set the $format, and compile it for command validation if settable */
+  void setFormat(std::string f);
+
+  std::string getUnit() { return *unit; };
+  void setUnit(std::string s) { unit = InternedString(s); };
 
   bool getRetained() { return retained; }
   void setRetained(bool b) { retained = b; }
@@ -79,9 +213,111 @@ public:
 
   Node *getNode() { return node; }
 
+  /** sizeof the most derived property class */
+  virtual size_t getObjectSize() { return sizeof(*this); }
+
+  /** Estimated RAM held by this property, see MemoryUsage */
+  MemoryUsage memoryUsage();
+
   void introduce();
+
+  /**
+   * @brief Produce the property's introduction message at index step
+   * (attributes, then the current value) and advance step. Empty optional
+   * attributes are skipped.
+   * @return false when the property is fully introduced
+   */
+  bool nextIntroduction(unsigned &step, Message &out);
+
+  /**
+   * @brief Read the current value from readerFunc, cache it as the published
+   * value and put it in out as a message to publish.
+   * @return false if there is nothing to publish yet, i.e. an asynchronous
+   * read is still producing the first value
+   */
+  bool getValueMessage(Message &out, int qos = 1);
   void publish(int qos = 1);
 
+  /**
+   * @brief Read the current value and cache it as published without sending
+   * it, for values that reach the broker some other way (Node snapshots).
+   */
+  std::string refreshValue();
+
+  /** Like publishIfChanged, but only caches the value, see refreshValue */
+  bool refreshIfChanged(unsigned long now);
+
+  /**
+   * @brief Read the value and publish it only if the publish policy says it
+   * changed since the last publication.
+   *
+   * @param now monotonic time in milliseconds, used for the heartbeat
+   * @return whether a message was sent
+   */
+  bool publishIfChanged(unsigned long now, int qos = 1);
+
+  /** Whether v would count as a change under the publish policy at now */
+  bool isChanged(const std::string &v, unsigned long now);
+
+  /**
+   * @brief Have Device::tick sample this property every interval ms and
+   * publish it according to the publish policy. 0 stops sampling.
+   */
+  void setSampleInterval(unsigned long interval);
+  unsigned long getSampleInterval() { return sampleInterval; }
+
+  PublishPolicy getPublishPolicy() { return policy; }
+  void setPublishPolicy(PublishPolicy p) { policy = p; }
+
   std::string read();
+
+  /** Time readerFunc calls, see Device::enableStats */
+  void enableReadStats();
+  /** readerFunc latency in microseconds, nullptr unless stats are enabled */
+  Log2Histogram *getReadLatency() { return readLatency.get(); }
+
+  /**
+   * @brief Store the value read by the node's bulk reader, without calling
+   * the writer. Publishing uses it in place of readerFunc.
+   */
+  void setSample(const std::string &v) { sampled.assign(v); }
+
+#ifdef HOMIE_THREADS
+  /**
+   * @brief Read through f instead of calling readerFunc inline. publish(),
+   * read(), introductions and scheduled samples then only start a read and
+   * use the cached value meanwhile, or skip the value before the first read
+   * completes; Device::tick publishes the result when it arrives, or the
+   * cached value, if any, once timeout ms have passed. At most one
+   * read per property is outstanding, so results are published in order.
+   */
+  void setAsyncReader(AsyncReaderFunc f, unsigned long timeout);
+
+  /**
+   * @brief Run readerFunc on a worker of pool rather than the calling thread.
+   * These reads are timed on the worker for getReadLatency, with
+   * std::chrono::steady_clock rather than Device::getMicros.
+   *
+   * Workers never touch the property, so they run a copy of readerFunc
+   * taken by this call: call it again after replacing readerFunc. The
+   * node's bulk reader and setSample are bypassed as well, so don't use
+   * this on a node with a bulk reader.
+   */
+  void setAsyncReader(WorkerPool &pool, unsigned long timeout);
+
+  bool hasAsyncReader() { return (bool)asyncRead; }
+
+  /** Start a read unless one is awaited already. Network thread only. */
+  void startRead(unsigned long now);
+
+  /**
+   * @brief Publish the awaited read, if it completed or timed out.
+   * @return true once nothing is awaited any more
+   */
+  bool pollRead(unsigned long now, int qos = 1);
+
+  /** Reads that timed out and fell back to the cached value */
+  unsigned long getReadTimeouts();
+#endif
 };
 } // namespace homie
@@ -0,0 +1,60 @@
+#pragma once
+#include "all.hpp"
+
+namespace homie {
+
+/**
+ * @brief A property value in 16 bytes. Integers and decimals are kept as a
+ * scaled int64_t (21.50 is 2150 with 2 decimals), booleans as a flag, other
+ * payloads of up to INLINE bytes in place and only longer ones on the heap.
+ * Numbers are only stored in binary when their text is canonical, so str()
+ * always returns exactly what was assigned.
+ */
+class PropertyValue {
+public:
+  enum Kind : uint8_t { EMPTY, INT, FLOAT, BOOL, SHORT, LONG };
+  static const size_t INLINE = 14;
+  /** buffer size view() needs to render a number or boolean */
+  static const size_t RENDER = 32;
+
+private:
+  /** the scaled int64_t, the flag, the text or a heap pointer and length */
+  char data[INLINE];
+  uint8_t kind;
+  /** SHORT: length, FLOAT: digits after the decimal point */
+  uint8_t aux;
+
+  /** format an INT, FLOAT or BOOL value into buf of RENDER bytes */
+  size_t render(char *buf) const;
+  /** the text of a SHORT or LONG value */
+  const char *text(size_t &len) const;
+  void release();
+
+public:
+  PropertyValue() : kind(EMPTY), aux(0) {}
+  PropertyValue(const PropertyValue &o);
+  PropertyValue &operator=(const PropertyValue &o);
+  ~PropertyValue() { release(); }
+
+  void assign(const char *s, size_t len);
+  void assign(const std::string &s) { assign(s.data(), s.size()); }
+
+  Kind getKind() const { return (Kind)kind; }
+  bool empty() const { return kind == EMPTY; }
+
+  std::string str() const;
+  /**
+   * @brief The text of the value without copying it: text is returned in
+   * place, numbers and booleans are rendered into buf of RENDER bytes.
+   * The result is not NUL-terminated and lives as long as the value and buf.
+   */
+  const char *view(char *buf, size_t &len) const;
+  bool equals(const std::string &s) const;
+
+  /** The leading number of the value, like strtod; false if there is none */
+  bool toDouble(double &d) const;
+
+  /** Bytes allocated for a LONG value, 0 otherwise */
+  size_t heapBytes() const;
+};
+} // namespace homie
@@ -0,0 +1,74 @@
+#pragma once
+#include "all.hpp"
+#include "memory_report.hpp"
+
+namespace homie {
+class Property;
+
+/**
+ * @brief Hashed timing wheel of periodic property samples.
+ *
+ * Each scheduled property sits in the wheel slot of its next due time.
+ * tick(now) visits only the slots that elapsed since the previous tick, so
+ * its cost depends on the number of due properties (plus any that share a
+ * slot but are due in a later revolution) rather than on the number of
+ * scheduled properties. Pick slots * resolution larger than the usual
+ * sample interval to keep those collisions rare.
+ *
+ * The first sample of each property is offset by a hash of its topic, so
+ * properties sharing an interval are spread across it instead of all firing
+ * at once.
+ */
+class Scheduler {
+private:
+  struct Entry {
+    Property *prop;
+    unsigned long due;
+    /** next entry in the same slot, -1 at the end */
+    int next;
+    bool active;
+  };
+
+  size_t slotCount;
+  unsigned long resolution;
+  std::vector<Entry> entries;
+  std::vector<int> slots;
+  std::unordered_map<Property *, int> index;
+  /** entries waiting for the first tick to learn the current time */
+  std::vector<int> pending;
+  /** entries collected during a tick, linked into their next slot after it */
+  std::vector<int> relink;
+  unsigned long lastTick;
+  bool started;
+
+  size_t slotOf(unsigned long t) { return (t / resolution) % slotCount; }
+  void link(int e);
+  void unlink(int e);
+  void collect(size_t slot, unsigned long now, std::vector<Property *> &due);
+
+public:
+  /**
+   * @param slots number of wheel slots
+   * @param resolution milliseconds covered by each slot
+   */
+  Scheduler(size_t slots = 128, unsigned long resolution = 100);
+
+  /**
+   * @brief Sample p every p->getSampleInterval() ms, or stop sampling it if
+   * the interval is 0.
+   */
+  void schedule(Property *p);
+
+  /**
+   * @brief Advance the wheel to now and append every property whose sample
+   * is due to the due list, in due order per slot. Each is rescheduled one
+   * interval later, skipping samples missed while the clock was not ticked.
+   */
+  void tick(unsigned long now, std::vector<Property *> &due);
+
+  size_t size() { return index.size(); }
+
+  /** Estimated bytes held by the wheel and its entry tables */
+  MemoryUsage memoryUsage();
+};
+} // namespace homie
@@ -0,0 +1,51 @@
+#pragma once
+#include "all.hpp"
+#include "enum.hpp"
+
+namespace homie {
+
+/** Whether a node publishes a whole-node snapshot, see Node::setSnapshot */
+enum SnapshotMode {
+  /** per-property messages only, the homie default */
+  SNAPSHOT_NONE = 0,
+  /** per-property messages and a snapshot */
+  SNAPSHOT_ALSO,
+  /** a snapshot instead of per-property messages */
+  SNAPSHOT_ONLY
+};
+
+enum SnapshotEncoding { SNAPSHOT_JSON = 0, SNAPSHOT_CBOR };
+
+/**
+ * @brief Streams a flat map of property id to value into a caller-owned
+ * buffer, as a JSON object or a CBOR map (RFC 8949). Values are typed by
+ * the property's DataType: integers, floats and booleans are encoded
+ * natively when the string parses as one, everything else as text.
+ *
+ * The buffer is cleared but keeps its capacity, so a buffer reused across
+ * snapshots stops allocating once it has grown to fit.
+ */
+class SnapshotWriter {
+private:
+  std::string &out;
+  SnapshotEncoding encoding;
+  size_t fields;
+
+  void cborHead(uint8_t major, uint64_t n);
+  void cborText(const char *s, size_t len);
+  void jsonText(const char *s, size_t len);
+
+public:
+  SnapshotWriter(std::string &buf, SnapshotEncoding encoding);
+
+  /** Start a map of count fields */
+  void begin(size_t count);
+  /** Add a field whose value is the len bytes at value */
+  void field(const std::string &key, DataType type, const char *value,
+             size_t len);
+  void field(const std::string &key, DataType type, const std::string &value) {
+    field(key, type, value.data(), value.size());
+  }
+  void end();
+};
+} // namespace homie
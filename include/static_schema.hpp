@@ -0,0 +1,320 @@
+#pragma once
+#include "all.hpp"
+#include "enum.hpp"
+#include "message.hpp"
+#if __cplusplus >= 201703L
+#include <string_view>
+#include <tuple>
+
+namespace homie {
+namespace schema {
+
+/*
+ * Compile-time device topology (C++17, see HOMIE_CXX17 in CMakeLists.txt).
+ *
+ *   static constexpr auto sensor = schema::device(
+ *       "homie", "sensor", "Sensor", "1.0",
+ *       schema::node("env", "Environment", "BME280",
+ *                    schema::property("temperature", "Temperature",
+ *                                     FLOAT).unit("°C")));
+ *   static constexpr auto intro = schema::introduction<sensor>();
+ *   static constexpr auto topics = schema::propertyTopics<sensor>();
+ *
+ * intro and topics are constant tables in rodata: every topic and payload is
+ * a std::string_view into one char array, so describing the device costs no
+ * heap at startup. The introduction holds the attributes that are fixed at
+ * build time ($homie, $name, $implementation, $extensions, $fw/..., $nodes,
+ * node and property attributes), in declaration order; $state, $localip,
+ * $mac and values stay with the runtime Device. The payloads match what
+ * Device::introduce produces for the same tree, except that a runtime
+ * Device lists nodes and properties sorted by id. The literals both use
+ * come from enum.hpp.
+ */
+
+/** A string literal, copied into the object so its length is part of it */
+template <size_t N> struct Text {
+  char chars[N + 1] = {};
+  constexpr Text() = default;
+  constexpr Text(const char (&s)[N + 1]) {
+    for (size_t i = 0; i < N; i++) {
+      chars[i] = s[i];
+    }
+  }
+  constexpr std::string_view view() const { return {chars, N}; }
+};
+template <size_t M> Text(const char (&)[M]) -> Text<M - 1>;
+
+template <size_t I, size_t N, size_t U, size_t F> struct PropertySpec {
+  Text<I> id;
+  Text<N> name;
+  DataType type;
+  bool isSettable;
+  Text<U> unitText;
+  Text<F> formatText;
+
+  constexpr auto settable(bool s = true) const {
+    return PropertySpec<I, N, U, F>{id, name, type, s, unitText, formatText};
+  }
+  template <size_t M> constexpr auto unit(const char (&u)[M]) const {
+    return PropertySpec<I, N, M - 1, F>{id,         name,           type,
+                                        isSettable, Text<M - 1>(u), formatText};
+  }
+  template <size_t M> constexpr auto format(const char (&f)[M]) const {
+    return PropertySpec<I, N, U, M - 1>{id,         name,     type,
+                                        isSettable, unitText, Text<M - 1>(f)};
+  }
+};
+
+template <size_t I, size_t N>
+constexpr auto property(const char (&id)[I], const char (&name)[N],
+                        DataType type) {
+  return PropertySpec<I - 1, N - 1, 0, 0>{Text<I - 1>(id), Text<N - 1>(name),
+                                          type, false, {}, {}};
+}
+
+template <size_t I, size_t N, size_t T, class... Props> struct NodeSpec {
+  Text<I> id;
+  Text<N> name;
+  Text<T> type;
+  std::tuple<Props...> properties;
+};
+
+template <size_t I, size_t N, size_t T, class... Props>
+constexpr auto node(const char (&id)[I], const char (&name)[N],
+                    const char (&type)[T], Props... props) {
+  return NodeSpec<I - 1, N - 1, T - 1, Props...>{
+      Text<I - 1>(id), Text<N - 1>(name), Text<T - 1>(type),
+      std::tuple<Props...>(props...)};
+}
+
+template <size_t B, size_t I, size_t N, size_t V, class... Nodes>
+struct DeviceSpec {
+  Text<B> base;
+  Text<I> id;
+  Text<N> name;
+  Text<V> version;
+  std::tuple<Nodes...> nodes;
+};
+
+/** id must already be lower-case, as homie topics require */
+template <size_t B, size_t I, size_t N, size_t V, class... Nodes>
+constexpr auto device(const char (&base)[B], const char (&id)[I],
+                      const char (&name)[N], const char (&version)[V],
+                      Nodes... nodes) {
+  return DeviceSpec<B - 1, I - 1, N - 1, V - 1, Nodes...>{
+      Text<B - 1>(base), Text<I - 1>(id), Text<N - 1>(name),
+      Text<V - 1>(version), std::tuple<Nodes...>(nodes...)};
+}
+
+/** Offsets of one topic/payload pair in a Table */
+struct Entry {
+  size_t topic;
+  size_t topicLen;
+  size_t payload;
+  size_t payloadLen;
+};
+
+/** Topic/payload pairs packed into one char array */
+template <size_t C, size_t E> struct Table {
+  char text[C + 1] = {};
+  Entry entries[E > 0 ? E : 1] = {};
+
+  static constexpr size_t size() { return E; }
+  constexpr std::string_view topic(size_t i) const {
+    return {text + entries[i].topic, entries[i].topicLen};
+  }
+  constexpr std::string_view payload(size_t i) const {
+    return {text + entries[i].payload, entries[i].payloadLen};
+  }
+  /** Entry i as a Message, e.g. to send through Device::send */
+  Message message(size_t i) const {
+    return Message(std::string(topic(i)), std::string(payload(i)));
+  }
+  /** Index of the entry with this topic, or -1 */
+  constexpr int find(std::string_view t) const {
+    for (size_t i = 0; i < E; i++) {
+      if (topic(i) == t) {
+        return (int)i;
+      }
+    }
+    return -1;
+  }
+};
+
+/** Table sink that only sizes the output */
+struct Measure {
+  size_t chars = 0;
+  size_t entries = 0;
+  constexpr void begin() {}
+  constexpr void put(std::string_view s) { chars += s.size(); }
+  constexpr void split() {}
+  constexpr void end() { entries++; }
+};
+
+/** Table sink that fills a Table sized by Measure */
+template <size_t C, size_t E> struct Writer {
+  Table<C, E> table;
+  size_t pos = 0;
+  size_t n = 0;
+  constexpr void begin() { table.entries[n].topic = pos; }
+  constexpr void put(std::string_view s) {
+    for (char c : s) {
+      table.text[pos++] = c;
+    }
+  }
+  constexpr void split() {
+    table.entries[n].topicLen = pos - table.entries[n].topic;
+    table.entries[n].payload = pos;
+  }
+  constexpr void end() {
+    table.entries[n].payloadLen = pos - table.entries[n].payload;
+    n++;
+  }
+};
+
+template <class D, class Node, class S>
+constexpr void nodeTopic(const D &d, const Node &n, S &s) {
+  s.put(d.base.view());
+  s.put("/");
+  s.put(d.id.view());
+  s.put("/");
+  s.put(n.id.view());
+  s.put("/");
+}
+
+template <class D, class N, class S>
+constexpr void emitNode(const D &d, const N &n, S &s) {
+  auto attr = [&](std::string_view name) {
+    s.begin();
+    nodeTopic(d, n, s);
+    s.put(name);
+    s.split();
+  };
+  attr("$name");
+  s.put(n.name.view());
+  s.end();
+  attr("$type");
+  s.put(n.type.view());
+  s.end();
+  attr("$properties");
+  std::apply(
+      [&](const auto &...p) {
+        bool first = true;
+        ((s.put(first ? "" : ","), s.put(p.id.view()), first = false), ...);
+      },
+      n.properties);
+  s.end();
+  std::apply([&](const auto &...p) { (emitProperty(d, n, p, s), ...); },
+             n.properties);
+}
+
+template <class D, class N, class P, class S>
+constexpr void emitProperty(const D &d, const N &n, const P &p, S &s) {
+  auto attr = [&](std::string_view name, std::string_view value) {
+    s.begin();
+    nodeTopic(d, n, s);
+    s.put(p.id.view());
+    s.put("/");
+    s.put(name);
+    s.split();
+    s.put(value);
+    s.end();
+  };
+  attr("$name", p.name.view());
+  attr("$settable", p.isSettable ? "true" : "false");
+  attr("$datatype", DATA_TYPE_NAMES[(int)p.type]);
+  if (!p.unitText.view().empty()) {
+    attr("$unit", p.unitText.view());
+  }
+  if (!p.formatText.view().empty()) {
+    attr("$format", p.formatText.view());
+  }
+}
+
+template <class D, class S>
+constexpr void emitIntroduction(const D &d, S &s) {
+  auto attr = [&](std::string_view name) {
+    s.begin();
+    s.put(d.base.view());
+    s.put("/");
+    s.put(d.id.view());
+    s.put("/");
+    s.put(name);
+    s.split();
+  };
+  attr("$homie");
+  s.put(SPEC_VERSION);
+  s.end();
+  attr("$name");
+  s.put(d.name.view());
+  s.end();
+  attr("$implementation");
+  s.put(IMPLEMENTATION);
+  s.end();
+  attr("$extensions");
+  s.put(LEGACY_FIRMWARE_EXTENSION);
+  s.end();
+  attr("$fw/name");
+  s.put(d.id.view());
+  s.put("-firmware");
+  s.end();
+  attr("$fw/version");
+  s.put(d.version.view());
+  s.end();
+  attr("$nodes");
+  std::apply(
+      [&](const auto &...n) {
+        bool first = true;
+        ((s.put(first ? "" : ","), s.put(n.id.view()), first = false), ...);
+      },
+      d.nodes);
+  s.end();
+  std::apply([&](const auto &...n) { (emitNode(d, n, s), ...); }, d.nodes);
+}
+
+template <class D, class N, class S>
+constexpr void emitNodeTopics(const D &d, const N &n, S &s) {
+  std::apply(
+      [&](const auto &...p) {
+        ((s.begin(), nodeTopic(d, n, s), s.put(p.id.view()), s.split(),
+          nodeTopic(d, n, s), s.put(p.id.view()), s.put("/set"), s.end()),
+         ...);
+      },
+      n.properties);
+}
+
+/** One entry per property: its value topic and its /set topic */
+template <class D, class S> constexpr void emitTopics(const D &d, S &s) {
+  std::apply([&](const auto &...n) { (emitNodeTopics(d, n, s), ...); },
+             d.nodes);
+}
+
+/** The device's build-time introduction attributes, see the file comment */
+template <const auto &D> constexpr auto introduction() {
+  constexpr Measure m = [] {
+    Measure m;
+    emitIntroduction(D, m);
+    return m;
+  }();
+  Writer<m.chars, m.entries> w;
+  emitIntroduction(D, w);
+  return w.table;
+}
+
+/**
+ * @brief topic(i) is the value topic and payload(i) the command topic of the
+ * i'th property, in declaration order.
+ */
+template <const auto &D> constexpr auto propertyTopics() {
+  constexpr Measure m = [] {
+    Measure m;
+    emitTopics(D, m);
+    return m;
+  }();
+  Writer<m.chars, m.entries> w;
+  emitTopics(D, w);
+  return w.table;
+}
+} // namespace schema
+} // namespace homie
+#endif
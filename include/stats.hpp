@@ -0,0 +1,69 @@
+#pragma once
+#include "all.hpp"
+#ifdef HOMIE_THREADS
+#include <mutex>
+#endif
+
+namespace homie {
+
+/**
+ * @brief Fixed-size histogram with power-of-two buckets: bucket 0 counts
+ * zeros and bucket i values in [2^(i-1), 2^i). Recording is a few integer
+ * operations and never allocates.
+ */
+class Log2Histogram {
+public:
+  static const int BUCKETS = 33;
+
+private:
+  uint32_t buckets[BUCKETS];
+  uint32_t count;
+  uint64_t sum;
+  uint32_t max;
+
+public:
+  Log2Histogram() { reset(); }
+
+  void record(uint32_t v);
+  void reset();
+
+  uint32_t getCount() { return count; }
+  uint64_t getSum() { return sum; }
+  uint32_t getMax() { return max; }
+  uint32_t getBucket(int i) { return buckets[i]; }
+  uint32_t mean() { return count ? (uint32_t)(sum / count) : 0; }
+
+  /**
+   * @brief Upper bound of the bucket holding the p'th percentile (0-100),
+   * capped at the largest value seen. 0 when empty.
+   */
+  uint32_t percentile(double p);
+};
+
+/**
+ * @brief Counters and latency histograms of a device, see
+ * Device::enableStats. Times are in microseconds from Device::getMicros.
+ */
+struct DeviceStats {
+  unsigned long published;
+  unsigned long publishedBytes;
+  unsigned long received;
+  /**
+   * time to read a property value, across all properties; use recordRead
+   * and readPercentile, as properties may publish from several threads
+   */
+  Log2Histogram readMicros;
+#ifdef HOMIE_THREADS
+  std::mutex readLock;
+#endif
+  /** time spent in onMessage per inbound message */
+  Log2Histogram dispatchMicros;
+  /** duration of each introduce() */
+  Log2Histogram introduceMicros;
+
+  DeviceStats() : published(0), publishedBytes(0), received(0) {}
+
+  void recordRead(uint32_t micros);
+  uint32_t readPercentile(double p);
+};
+} // namespace homie
@@ -0,0 +1,68 @@
+#pragma once
+#include "all.hpp"
+#include "memory_report.hpp"
+#ifdef HOMIE_THREADS
+#include <mutex>
+#endif
+
+namespace homie {
+
+/**
+ * @brief Process-wide pool of immutable strings. Properties keep their id,
+ * name, unit and format as InternedString references into it, so each
+ * distinct text is held once however many properties and devices use it.
+ * Entries are counted and freed once the last reference is released, e.g.
+ * when a device is removed from a DeviceRegistry.
+ */
+class StringTable {
+private:
+  /** text to number of references */
+  std::unordered_map<std::string, size_t> strings;
+#ifdef HOMIE_THREADS
+  std::mutex lock;
+#endif
+
+public:
+  static StringTable &shared();
+
+  /**
+   * @brief The pooled copy of s, holding one reference to it. It stays put
+   * until the matching release().
+   */
+  const std::string *intern(const std::string &s);
+  /** Take another reference to an interned string */
+  void retain(const std::string *s);
+  /** Drop a reference, freeing the string with the last one */
+  void release(const std::string *s);
+
+  size_t size();
+
+  /** Map nodes, buckets and string bytes held by the table */
+  MemoryUsage memoryUsage();
+};
+
+/** A counted reference to a StringTable::shared() entry */
+class InternedString {
+private:
+  const std::string *s;
+
+public:
+  explicit InternedString(const std::string &text)
+      : s(StringTable::shared().intern(text)) {}
+  InternedString(const InternedString &o) : s(o.s) {
+    StringTable::shared().retain(s);
+  }
+  InternedString &operator=(const InternedString &o) {
+    StringTable::shared().retain(o.s);
+    StringTable::shared().release(s);
+    s = o.s;
+    return *this;
+  }
+  ~InternedString() { StringTable::shared().release(s); }
+
+  const std::string &operator*() const { return *s; }
+  const std::string *operator->() const { return s; }
+  /** The pooled string, valid while this reference lives */
+  const std::string *get() const { return s; }
+};
+} // namespace homie
@@ -0,0 +1,65 @@
+#pragma once
+#include "all.hpp"
+
+namespace homie {
+class Message;
+
+typedef std::function<void(const Message &)> MessageHandler;
+
+/**
+ * @brief MQTT topic filters with their handlers, stored as a trie of topic
+ * levels with `+` and `#` edges. Matching a topic walks it level by level,
+ * so the cost depends on the topic depth and the wildcards that actually
+ * match, not on the number of subscriptions.
+ *
+ * As in MQTT, a filter starting with a wildcard doesn't match topics
+ * starting with `$`, and `a/#` matches `a` itself.
+ */
+class SubscriptionTrie {
+private:
+  struct Level {
+    std::unordered_map<std::string, std::unique_ptr<Level>> children;
+    std::unique_ptr<Level> plus;
+    /** handlers of filters ending at this level */
+    std::vector<MessageHandler> exact;
+    /** handlers of filters ending in # below this level */
+    std::vector<MessageHandler> multi;
+  };
+  Level root;
+  /** filters and how many handlers each one has */
+  std::map<std::string, size_t> filters;
+  /** scratch key for child lookups */
+  std::string key;
+
+  size_t match(Level *level, const std::string &topic, size_t pos,
+               const Message &m);
+
+public:
+  /**
+   * @brief Call h for every message matching filter.
+   * @return false, adding nothing, if filter isn't a valid MQTT filter
+   */
+  bool add(const std::string &filter, MessageHandler h);
+
+  /** Drop every handler of filter. @return whether there were any */
+  bool remove(const std::string &filter);
+
+  /** Call the handlers of every filter matching m.topic. @return how many */
+  size_t dispatch(const Message &m);
+
+  /** Number of distinct filters */
+  size_t size() { return filters.size(); }
+
+  /**
+   * @brief The filters to actually subscribe with: every filter that isn't
+   * already covered by another one, e.g. `a/+/c` is dropped in favour of
+   * `a/#`.
+   */
+  std::vector<std::string> minimalFilters();
+
+  static bool isValidFilter(const std::string &filter);
+
+  /** Whether every topic matched by specific is also matched by general */
+  static bool covers(const std::string &general, const std::string &specific);
+};
+} // namespace homie
@@ -0,0 +1,52 @@
+#pragma once
+#include "all.hpp"
+
+namespace homie {
+
+/**
+ * @brief Token bucket rate limiter driven by a caller-supplied millisecond
+ * clock. Tokens refill continuously at the configured rate up to the burst
+ * size. A rate of zero means unlimited.
+ *
+ */
+class TokenBucket {
+private:
+  /** tokens added per second, 0 = unlimited */
+  unsigned long rate;
+  /** maximum tokens the bucket holds */
+  unsigned long burst;
+  /** current fill level in thousandths of a token, may go negative */
+  long long level;
+  unsigned long lastRefill;
+  bool started;
+
+public:
+  TokenBucket(unsigned long ratePerSec = 0, unsigned long burst = 0);
+
+  /**
+   * @brief Change rate and burst. A burst of 0 defaults to one second's
+   * worth of tokens. The bucket starts full.
+   */
+  void configure(unsigned long ratePerSec, unsigned long burst = 0);
+
+  bool isLimited() { return rate > 0; }
+  unsigned long getRate() { return rate; }
+  unsigned long getBurst() { return burst; }
+
+  void refill(unsigned long now);
+
+  /**
+   * @brief Whether n tokens are available. A full bucket always admits one
+   * request, even one larger than the burst size, so that oversized items
+   * are delayed rather than blocked forever.
+   */
+  bool canTake(unsigned long n);
+  void take(unsigned long n);
+
+  /** ms after the last refill until canTake(n) holds, 0 if it does now */
+  unsigned long waitFor(unsigned long n);
+
+  /** refill, then take n tokens if available */
+  bool tryTake(unsigned long n, unsigned long now);
+};
+} // namespace homie
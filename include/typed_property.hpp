@@ -0,0 +1,147 @@
+#pragma once
+#include "format.hpp"
+#include "property.hpp"
+
+namespace homie {
+
+/** Value type of a TypedProperty holding a position in its enum $format */
+struct EnumIndex {
+  uint8_t index;
+  EnumIndex(uint8_t i = 0) : index(i) {}
+  bool operator==(const EnumIndex &o) const { return index == o.index; }
+};
+
+/** Maps a native value type to its homie $datatype at compile time */
+template <typename T> struct DataTypeOf;
+template <> struct DataTypeOf<int32_t> {
+  static const DataType value = INTEGER;
+};
+template <> struct DataTypeOf<float> { static const DataType value = FLOAT; };
+template <> struct DataTypeOf<bool> { static const DataType value = BOOLEAN; };
+template <> struct DataTypeOf<EnumIndex> {
+  static const DataType value = ENUM;
+};
+
+inline size_t formatNative(int32_t v, int, const std::string &, char *buf,
+                           size_t len) {
+  return formatInt(v, buf, len);
+}
+inline size_t formatNative(float v, int decimals, const std::string &,
+                           char *buf, size_t len) {
+  return formatFloat(v, decimals, buf, len);
+}
+inline size_t formatNative(bool v, int, const std::string &, char *buf,
+                           size_t len) {
+  return formatBool(v, buf, len);
+}
+inline size_t formatNative(EnumIndex v, int, const std::string &list,
+                           char *buf, size_t len) {
+  return formatEnum(v.index, list, buf, len);
+}
+
+inline bool fromCommand(const CommandValue &c, int32_t &out) {
+  if (c.type != INTEGER || c.integer < INT32_MIN || c.integer > INT32_MAX) {
+    return false;
+  }
+  out = (int32_t)c.integer;
+  return true;
+}
+inline bool fromCommand(const CommandValue &c, float &out) {
+  if (c.type != FLOAT && c.type != PERCENT) {
+    return false;
+  }
+  out = (float)c.number;
+  return true;
+}
+inline bool fromCommand(const CommandValue &c, bool &out) {
+  if (c.type != BOOLEAN) {
+    return false;
+  }
+  out = c.boolean;
+  return true;
+}
+inline bool fromCommand(const CommandValue &c, EnumIndex &out) {
+  if (c.type != ENUM) {
+    return false;
+  }
+  out = EnumIndex(c.index);
+  return true;
+}
+
+/**
+ * @brief A property that keeps its value in native form (int32_t, float,
+ * bool or EnumIndex) and derives its homie $datatype from T.
+ *
+ * The value is only turned into text at publish time, by formatting into a
+ * stack buffer; short results fit the std::string small-buffer, so the
+ * telemetry path neither allocates nor touches iostreams.
+ *
+ * The value comes from an optional native reader, or from the last set().
+ * Enum values are rendered using the property's $format list.
+ */
+template <typename T> class TypedProperty : public Property {
+private:
+  T native;
+  std::function<T(void)> nativeReader;
+  /** digits after the decimal point for float values */
+  int decimals;
+
+public:
+  TypedProperty(Node *anode, std::string id, std::string name,
+                bool settable = false,
+                std::function<T(void)> reader = nullptr)
+      : Property(anode, id, name, DataTypeOf<T>::value, settable,
+                 [this]() { return this->formatted(); }),
+        native(), nativeReader(reader), decimals(2) {}
+
+  size_t getObjectSize() override { return sizeof(*this); }
+
+  T get() { return native; }
+  void set(T v) { native = v; }
+
+  void setDecimals(int d) { decimals = d; }
+  int getDecimals() { return decimals; }
+
+  /**
+   * @brief Refresh the value from the native reader, if any, and format it
+   * into buf.
+   * @return length written, 0 if buf is too small
+   */
+  size_t write(char *buf, size_t len) {
+    if (nativeReader) {
+      native = nativeReader();
+    }
+    return formatNative(native, decimals, getFormat(), buf, len);
+  }
+
+  std::string formatted() {
+    // room for any float: sign, 39 digits, point, 9 decimals and NUL
+    char buf[std::numeric_limits<float>::max_exponent10 + 13];
+    size_t n = write(buf, sizeof(buf));
+    if (n > 0) {
+      return std::string(buf, n);
+    }
+    // only an enum entry can be longer; it can't exceed its $format
+    std::string s(getFormat().length() + 1, '\0');
+    s.resize(formatNative(native, decimals, getFormat(), &s[0], s.size()));
+    return s;
+  }
+
+  /**
+   * @brief Install a writer that receives commands already parsed into T,
+   * see Property::setTypedWriter. Payloads that don't parse are ignored.
+   */
+  void setNativeWriter(std::function<void(T)> f) {
+    setTypedWriter([f](const CommandValue &c) {
+      T v;
+      if (fromCommand(c, v)) {
+        f(v);
+      }
+    });
+  }
+
+protected:
+  /** Keep native in step with every accepted command, whatever the writer */
+  void onCommand(const CommandValue &c) override { fromCommand(c, native); }
+};
+} // namespace homie
@@ -0,0 +1,66 @@
+#pragma once
+#include "all.hpp"
+#include "enum.hpp"
+
+namespace homie {
+
+/**
+ * @brief A command payload parsed according to its property's $datatype.
+ * STRING, DATETIME and DURATION payloads carry no parsed value.
+ */
+struct CommandValue {
+  DataType type;
+  union {
+    /** INTEGER */
+    int64_t integer;
+    /** FLOAT and PERCENT */
+    double number;
+    /** BOOLEAN */
+    bool boolean;
+    /** ENUM: position in the $format list */
+    uint8_t index;
+    /** COLOR: r,g,b or h,s,v */
+    uint16_t color[3];
+  };
+
+  CommandValue() : type(STRING), integer(0) {}
+};
+
+/**
+ * @brief A property's $datatype and $format compiled into a validator for
+ * command payloads, see Property::setFormat.
+ *
+ * Integer and float formats "from:to" bound the value inclusively; either
+ * side may be left empty. Enum formats list the accepted payloads. Color
+ * formats are "rgb" (0-255 each) or "hsv" (0-360, 0-100, 0-100); an empty
+ * color format means rgb. A malformed range is ignored.
+ */
+class ValueFormat {
+private:
+  DataType type;
+  bool hasMin, hasMax;
+  int64_t intMin, intMax;
+  double floatMin, floatMax;
+  bool hsv;
+  /** enum entries as (offset, length) into list */
+  std::vector<std::pair<uint16_t, uint16_t>> entries;
+  /** the enum $format; must outlive this, e.g. a StringTable entry */
+  const std::string *list;
+
+public:
+  ValueFormat(DataType type = STRING, const std::string *format = nullptr);
+
+  DataType getType() const { return type; }
+
+  /**
+   * @brief Check payload against the datatype and format and parse it.
+   * @return false if the payload is malformed or out of range
+   */
+  bool parse(const std::string &payload, CommandValue &out) const;
+
+  /** Heap bytes held by the compiled enum list */
+  size_t heapBytes() const {
+    return entries.capacity() * sizeof(entries[0]);
+  }
+};
+} // namespace homie
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#define HOMIE_LIB_VERSION "2.0.11"
 namespace homie {
-const std::string LIB_VERSION = "2.0.11";
+const std::string LIB_VERSION = HOMIE_LIB_VERSION;
 }
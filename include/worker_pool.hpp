@@ -0,0 +1,73 @@
+#pragma once
+#include "all.hpp"
+#ifdef HOMIE_THREADS
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace homie {
+
+/**
+ * @brief A few threads working through a FIFO of tasks. Used to run slow
+ * property readers (I2C, 1-Wire, ...) off the network thread, see
+ * Property::setAsyncReader.
+ */
+class WorkerPool {
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex lock;
+  std::condition_variable wake;
+  bool stopping;
+
+  void run();
+
+public:
+  WorkerPool(size_t threads = 1);
+  /** Finishes the queued tasks, then joins the workers */
+  ~WorkerPool();
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  void submit(std::function<void()> task);
+  size_t size() { return workers.size(); }
+};
+
+/** Starts a read and eventually calls done(value), from any thread */
+typedef std::function<void(std::function<void(std::string)> done)>
+    AsyncReaderFunc;
+
+/**
+ * @brief State of a property's asynchronous read, shared with the
+ * completion callback so a late completion never outlives it.
+ */
+struct AsyncRead {
+  AsyncReaderFunc start;
+  /** set instead of start to run a copy of readerFunc on a worker */
+  WorkerPool *pool;
+  std::function<std::string(void)> reader;
+  /** milliseconds to wait before falling back to the cached value */
+  unsigned long timeout;
+
+  std::mutex lock;
+  /** a read is outstanding, possibly already given up on */
+  bool running;
+  /** the result of the current read has arrived */
+  bool ready;
+  std::string result;
+  /** duration of a pool read, in Device::getMicros units */
+  uint32_t micros;
+  bool timed;
+
+  /** network thread only: waiting for the current read since startedAt */
+  bool awaiting;
+  unsigned long startedAt;
+  unsigned long timeouts;
+
+  AsyncRead(AsyncReaderFunc f, unsigned long t)
+      : start(f), pool(nullptr), timeout(t), running(false), ready(false),
+        micros(0), timed(false), awaiting(false), startedAt(0), timeouts(0) {}
+};
+} // namespace homie
+#endif
@@ -0,0 +1,23 @@
+#include "homie.hpp"
+namespace homie {
+Arena::Arena(size_t bytes) {
+  base = (char *)malloc(bytes);
+  capacity = base ? bytes : 0;
+  used = 0;
+  allocations = 0;
+  overflows = 0;
+}
+
+Arena::~Arena() { free(base); }
+
+void *Arena::allocate(size_t size, size_t align) {
+  size_t start = (used + align - 1) & ~(align - 1);
+  if (start + size > capacity || start < used) {
+    overflows++;
+    return nullptr;
+  }
+  used = start + size;
+  allocations++;
+  return base + start;
+}
+} // namespace homie
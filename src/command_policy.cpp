@@ -0,0 +1,73 @@
+#include "homie.hpp"
+namespace homie {
+CommandLimiter::CommandLimiter(const CommandPolicy &p)
+    : policy(p), bucket(p.maxRate, p.burst), pending(false), throttled(false),
+      dueAt(0), written(false), lastWrite(0), dropped(0), coalesced(0) {}
+
+unsigned long CommandLimiter::nextWrite(unsigned long now) {
+  if (!written || policy.minInterval == 0) {
+    return now;
+  }
+  unsigned long earliest = lastWrite + policy.minInterval;
+  // signed difference copes with clock wrap-around
+  return (long)(earliest - now) > 0 ? earliest : now;
+}
+
+bool CommandLimiter::admit(unsigned long now) {
+  if (!bucket.tryTake(1, now)) {
+    // wait for the next token rather than lose the command
+    throttled = true;
+    dueAt = now + bucket.waitFor(1);
+    return false;
+  }
+  throttled = false;
+  written = true;
+  lastWrite = now;
+  return true;
+}
+
+CommandLimiter::Action CommandLimiter::offer(const std::string &p,
+                                             const CommandValue &v,
+                                             unsigned long now) {
+  if (pending) {
+    if (throttled) {
+      dropped++;
+    } else {
+      coalesced++;
+    }
+  }
+  unsigned long due =
+      policy.debounce > 0 ? now + policy.debounce : nextWrite(now);
+  if (due == now && admit(now)) {
+    pending = false;
+    return WRITE;
+  }
+  if (due != now) {
+    throttled = false;
+    dueAt = due;
+  }
+  pending = true;
+  payload = p;
+  value = v;
+  return DEFER;
+}
+
+bool CommandLimiter::poll(unsigned long now, std::string &p,
+                          CommandValue &v) {
+  if (!pending || (long)(now - dueAt) < 0) {
+    return false;
+  }
+  unsigned long next = nextWrite(now);
+  if (next != now) {
+    dueAt = next;
+    return false;
+  }
+  if (!admit(now)) {
+    return false;
+  }
+  pending = false;
+  p.swap(payload);
+  v = value;
+  return true;
+}
+} // namespace homie
@@ -3,7 +3,10 @@
 namespace homie {
 
 Device::Device(std::string aid, std::string aVersion, std::string aname,
-               std::string homieTopicBase) {
+               std::string homieTopicBase, size_t arenaBytes) {
+  if (arenaBytes > 0) {
+    arena.reset(new Arena(arenaBytes));
+  }
   id = aid;
   this->homieTopicBase = homieTopicBase;
 
@@ -16,22 +19,36 @@ Device::Device(std::string aid, std::string aVersion, std::string aname,
   name = aname;
   this->topicBase = this->homieTopicBase;
   this->topicBase += "/" + id + "/";
-  extensions.push_back(std::string("org.homie.legacy-firmware:0.1.1:[4.x]"));
+  extensions.push_back(LEGACY_FIRMWARE_EXTENSION);
   lifecycleState = INIT;
+  registry = nullptr;
+  lastTick = 0;
+#ifdef HOMIE_MMAP
+  recorder = nullptr;
+#endif
 
-  this->wifiNode = new Node(this, NODE_NM_WIFI, "WiFi", "WIFI");
-  this->rssiProp =
-      new Property(this->wifiNode, PROP_NM_RSSI, "RSSI", homie::INTEGER, false,
-                   [this]() { return to_string(this->getRssi()); });
-  this->wifiSignalProp = new Property(
+  this->wifiNode = create<Node>(this, NODE_NM_WIFI, "WiFi", "WIFI");
+  this->rssiProp = create<Property>(
+      this->wifiNode, PROP_NM_RSSI, "RSSI", homie::INTEGER, false,
+      [this]() { return to_string(this->getRssi()); });
+  this->wifiSignalProp = create<Property>(
       this->wifiNode, PROP_NM_WIFI_SIGNAL, "Wifi Signal", homie::INTEGER, false,
       [this]() { return to_string(this->getWifiSignalStrength()); });
-  this->localIpProp =
-      new Property(this->wifiNode, "localip", "Local IP", homie::STRING, false,
-                   [this]() { return this->localIp; });
-  this->macProp =
-      new Property(this->wifiNode, "mac", "MAC Address", homie::STRING, false,
-                   [this]() { return formatMac(this->mac); });
+  this->localIpProp = create<Property>(
+      this->wifiNode, "localip", "Local IP", homie::STRING, false,
+      [this]() { return this->localIp; });
+  this->macProp = create<Property>(
+      this->wifiNode, "mac", "MAC Address", homie::STRING, false,
+      [this]() { return formatMac(this->mac); });
+  this->memoryNode = nullptr;
+  this->statsNode = nullptr;
+  this->statsInterval = 0;
+  this->lastStatsAt = 0;
+  this->lastStatsPublished = 0;
+  this->lastStatsBytes = 0;
+  this->publishRate = 0;
+  this->rssiProp->setPublishPolicy(PublishPolicy(3, 0, 300000));
+  this->wifiSignalProp->setPublishPolicy(PublishPolicy(5, 0, 300000));
 }
 
 void Device::publishWifi() {
@@ -39,6 +56,167 @@ void Device::publishWifi() {
   this->wifiSignalProp->publish();
 }
 
+void Device::publishWifi(unsigned long now) {
+  this->rssiProp->publishIfChanged(now);
+  this->wifiSignalProp->publishIfChanged(now);
+}
+
+void Device::deliver(const Message &m) {
+  if (stats) {
+    stats->published++;
+    stats->publishedBytes += m.topic.length() + m.payload.length();
+  }
+#ifdef HOMIE_MMAP
+  if (recorder) {
+    recorder->append(LOG_PUBLISHED, m);
+  }
+#endif
+  if (registry) {
+    registry->publish(m);
+  } else {
+    this->publish(m);
+  }
+}
+
+void Device::send(const Message &m, const Property *source) {
+#ifdef HOMIE_THREADS
+  if (concurrentOutbox) {
+    concurrentOutbox->push(Outgoing(m, source));
+    return;
+  }
+#endif
+  if (outbox) {
+    outbox->push(m, source);
+    return;
+  }
+  deliver(m);
+}
+
+void Device::enableOutbox(size_t capacity, unsigned long messagesPerSec,
+                          unsigned long bytesPerSec, bool coalesce) {
+  outbox.reset(new Outbox(capacity, messagesPerSec, bytesPerSec, coalesce));
+}
+
+#ifdef HOMIE_THREADS
+void Device::enableConcurrentSend(size_t capacity) {
+  concurrentOutbox.reset(new MpscRing<Outgoing>(capacity));
+}
+
+size_t Device::drain() {
+  if (!concurrentOutbox) {
+    return 0;
+  }
+  size_t n = 0;
+  Outgoing o;
+  while (concurrentOutbox->pop(o)) {
+    if (outbox) {
+      outbox->push(o.message, o.key);
+    } else {
+      deliver(o.message);
+    }
+    n++;
+  }
+  return n;
+}
+#endif
+
+size_t Device::pump(unsigned long now) {
+#ifdef HOMIE_THREADS
+  drain();
+#endif
+  if (!outbox) {
+    return 0;
+  }
+  size_t n = 0;
+  Message m;
+  while (outbox->pop(now, m)) {
+    deliver(m);
+    n++;
+  }
+  return n;
+}
+
+size_t Device::tick(unsigned long now) {
+  lastTick.store(now, std::memory_order_relaxed);
+  dueBatch.clear();
+  scheduler.tick(now, dueBatch);
+  sampledNodes.clear();
+  for (auto p : dueBatch) {
+    Node *node = p->getNode();
+    bool snapshot = node->getSnapshotMode() != SNAPSHOT_NONE;
+    bool first = false;
+    if (snapshot || node->hasBulkReader()) {
+      first = std::find(sampledNodes.begin(), sampledNodes.end(), node) ==
+              sampledNodes.end();
+      if (first) {
+        sampledNodes.push_back(node);
+      }
+    }
+    if (snapshot) {
+      // a snapshot node is published as a whole when any property is due
+      if (first) {
+        node->publishIfChanged(now);
+      }
+      continue;
+    }
+    if (first) {
+      node->sample();
+    }
+    p->publishIfChanged(now);
+  }
+#ifdef HOMIE_THREADS
+  pollReads(now);
+#endif
+  pollCommands(now);
+  if (statsNode && statsInterval > 0 && now - lastStatsAt >= statsInterval) {
+    publishStats(now);
+  }
+  pump(now);
+  return dueBatch.size();
+}
+
+void Device::awaitCommand(Property *p) {
+  if (std::find(pendingCommands.begin(), pendingCommands.end(), p) ==
+      pendingCommands.end()) {
+    pendingCommands.push_back(p);
+  }
+}
+
+size_t Device::pollCommands(unsigned long now) {
+  size_t i = 0;
+  while (i < pendingCommands.size()) {
+    if (pendingCommands[i]->pollCommand(now)) {
+      pendingCommands[i] = pendingCommands.back();
+      pendingCommands.pop_back();
+    } else {
+      i++;
+    }
+  }
+  return pendingCommands.size();
+}
+
+#ifdef HOMIE_THREADS
+void Device::awaitRead(Property *p) {
+  if (std::find(awaitingReads.begin(), awaitingReads.end(), p) ==
+      awaitingReads.end()) {
+    awaitingReads.push_back(p);
+  }
+}
+
+size_t Device::pollReads(unsigned long now) {
+  size_t i = 0;
+  while (i < awaitingReads.size()) {
+    if (awaitingReads[i]->pollRead(now)) {
+      awaitingReads[i] = awaitingReads.back();
+      awaitingReads.pop_back();
+    } else {
+      i++;
+    }
+  }
+  return awaitingReads.size();
+}
+#endif
+
 void Device::addNode(Node *n) { nodes[n->getId()] = n; }
 
 Node *Device::getNode(std::string nm) {
@@ -49,47 +227,307 @@ Node *Device::getNode(std::string nm) {
   return search->second;
 }
 
+void Device::addRoute(Property *p) {
+  if (registry) {
+    registry->addRoute(p);
+    return;
+  }
+  routes[p->getSubTopic()] = p;
+}
+
+Property *Device::findRoute(const std::string &topic) {
+  if (registry) {
+    return registry->findRoute(topic);
+  }
+  auto search = routes.find(topic);
+  if (search == routes.end()) {
+    return nullptr;
+  }
+  return search->second;
+}
+
+void Device::setRegistry(DeviceRegistry *r) {
+  registry = r;
+  for (auto &e : routes) {
+    registry->addRoute(e.second);
+  }
+  std::unordered_map<std::string, Property *>().swap(routes);
+}
+
+bool Device::nextIntroduction(unsigned &step, Message &out) {
+  std::string list;
+  int i = 0;
+  switch (step++) {
+  case 0:
+    out = Message(topicBase + "$homie", HOMIE_VERSION);
+    return true;
+  case 1:
+    out = Message(topicBase + "$name", name);
+    return true;
+  case 2:
+    out = Message(topicBase + "$implementation", IMPLEMENTATION);
+    return true;
+  case 3:
+    this->setLifecycleState(homie::INIT);
+    out = getLifecycleMsg();
+    return true;
+  case 4:
+    for (auto elm : extensions) {
+      if (i++ > 0) {
+        list += ",";
+      }
+      list += elm;
+    }
+    out = Message(topicBase + "$extensions", list);
+    return true;
+  case 5:
+    out = Message(topicBase + "$localip", this->localIpProp->readerFunc());
+    return true;
+  case 6:
+    out = Message(topicBase + "$mac", this->macProp->readerFunc());
+    return true;
+  case 7:
+    out = Message(topicBase + "$fw/name", id + "-firmware");
+    return true;
+  case 8:
+    out = Message(topicBase + "$fw/version", version);
+    return true;
+  case 9:
+    for (auto &elm : nodes) {
+      if (i++ > 0) {
+        list += ",";
+      }
+      list += elm.first;
+    }
+    out = Message(topicBase + "$nodes", list);
+    return true;
+  default:
+    return false;
+  }
+}
+
 void Device::introduce() {
-  int i;
-  this->publish(Message(topicBase + "$homie", HOMIE_VERSION));
-  this->publish(Message(topicBase + "$name", name));
-  auto impl = std::string("cslhomie");
-  impl += "-" + homie::LIB_VERSION;
-  this->publish(Message(topicBase + "$implementation", impl));
-  this->setLifecycleState(homie::INIT);
-  this->publish(getLifecycleMsg());
-
-  std::string exts("");
-  i = 0;
-  for (auto elm : extensions) {
-    if (i++ > 0) {
-      exts += ",";
+  uint64_t start = stats ? getMicros() : 0;
+  Introduction intro(this);
+  Message m;
+  while (intro.next(m)) {
+    this->send(m);
+  }
+  if (stats) {
+    stats->introduceMicros.record((uint32_t)(getMicros() - start));
+  }
+}
+
+std::string Device::getFingerprint() {
+  Fingerprint fp;
+  fp.update(HOMIE_VERSION);
+  fp.update(LIB_VERSION);
+  fp.update(id);
+  fp.update(name);
+  fp.update(version);
+  fp.update(this->localIpProp->readerFunc());
+  fp.update(this->macProp->readerFunc());
+  for (auto &ext : extensions) {
+    fp.update(ext);
+  }
+  for (auto &ne : nodes) {
+    Node *node = ne.second;
+    fp.update(node->getId());
+    fp.update(node->getName());
+    fp.update(node->getType());
+    for (auto &pe : node->getProperties()) {
+      Property *prop = pe.second;
+      fp.update(prop->getId());
+      fp.update(prop->getName());
+      fp.update(prop->getDataTypeString());
+      fp.update(prop->getUnit());
+      fp.update(prop->getFormat());
+      fp.update(prop->isSettable());
+      fp.update(prop->getRetained());
     }
-    exts += elm;
   }
-  this->publish(Message(topicBase + "$extensions", exts));
+  return fp.hex();
+}
+
+MemoryReport Device::memoryReport() {
+  MemoryReport r;
+  MemoryUsage &u = r.device;
+  u.objects = sizeof(*this);
+  u.strings = heapBytes(id) + heapBytes(name) + heapBytes(version) +
+              heapBytes(mac) + heapBytes(localIp) + heapBytes(topicBase) +
+              heapBytes(homieTopicBase) + heapBytes(publishedFingerprint);
+  u.containers = extensions.capacity() * sizeof(std::string) +
+                 dueBatch.capacity() * sizeof(Property *) +
+                 sampledNodes.capacity() * sizeof(Node *) +
+                 pendingCommands.capacity() * sizeof(Property *);
+#ifdef HOMIE_THREADS
+  u.containers += awaitingReads.capacity() * sizeof(Property *);
+#endif
+  for (auto &ext : extensions) {
+    u.strings += heapBytes(ext);
+  }
+  for (auto &e : routes) {
+    u.containers += hashNodeBytes(sizeof(e));
+    u.strings += heapBytes(e.first);
+  }
+  u.containers += routes.bucket_count() * sizeof(void *);
+  u += scheduler.memoryUsage();
+  if (outbox) {
+    u.objects += sizeof(Outbox);
+    u += outbox->memoryUsage();
+  }
+  if (stats) {
+    u.objects += sizeof(DeviceStats);
+  }
+  if (arena) {
+    // reserved but not yet handed out; used bytes are counted per object
+    u.objects += sizeof(Arena) + arena->getFree();
+  }
+  for (auto &e : nodes) {
+    u.containers += mapNodeBytes(sizeof(e));
+    u.strings += heapBytes(e.first);
+  }
+  r.total = u;
+  r.sharedStrings = StringTable::shared().memoryUsage();
+  for (auto &e : nodes) {
+    NodeMemory nm;
+    nm.id = e.first;
+    nm.propertyCount = e.second->getProperties().size();
+    nm.usage = e.second->memoryUsage();
+    r.total += nm.usage;
+    r.nodes.push_back(nm);
+  }
+  return r;
+}
+
+void Device::enableMemoryNode() {
+  if (memoryNode) {
+    return;
+  }
+  memoryNode = create<Node>(this, "memory", "Memory", "diagnostics");
+  struct Field {
+    const char *id;
+    const char *name;
+    size_t MemoryUsage::*member;
+  };
+  static const Field fields[] = {
+      {"objects", "Objects", &MemoryUsage::objects},
+      {"strings", "Strings", &MemoryUsage::strings},
+      {"containers", "Containers", &MemoryUsage::containers},
+      {"functions", "Functions", &MemoryUsage::functions}};
+  auto total = create<Property>(memoryNode, "total", "Total", homie::INTEGER,
+                                false, [this]() {
+                                  return to_string(
+                                      (int)lastMemoryReport.total.total());
+                                });
+  total->setUnit("B");
+  for (auto &f : fields) {
+    auto member = f.member;
+    auto p = create<Property>(memoryNode, f.id, f.name, homie::INTEGER, false,
+                              [this, member]() {
+                                return to_string(
+                                    (int)(lastMemoryReport.total.*member));
+                              });
+    p->setUnit("B");
+  }
+  create<Property>(memoryNode, "nodes", "Per node", homie::STRING, false,
+                   [this]() {
+                     std::string s;
+                     for (auto &nm : lastMemoryReport.nodes) {
+                       if (!s.empty()) {
+                         s += ',';
+                       }
+                       s += nm.id + "=" + to_string((int)nm.usage.total());
+                     }
+                     return s;
+                   });
+}
+
+void Device::publishMemory() {
+  if (!memoryNode) {
+    return;
+  }
+  lastMemoryReport = memoryReport();
+  for (auto &e : memoryNode->getProperties()) {
+    e.second->publish();
+  }
+}
 
-  this->publish(
-      Message(topicBase + "$localip", this->localIpProp->readerFunc()));
-  this->publish(Message(topicBase + "$mac", this->macProp->readerFunc()));
-  this->publish(Message(topicBase + "$fw/name", id + "-firmware"));
-  this->publish(Message(topicBase + "$fw/version", version));
+uint64_t Device::getMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
-  std::string nodeList("");
-  i = 0;
-  for (auto elm : nodes) {
-    if (i++ > 0) {
-      nodeList += ",";
+void Device::enableStats() {
+  if (stats) {
+    return;
+  }
+  stats.reset(new DeviceStats());
+  for (auto &n : nodes) {
+    for (auto &p : n.second->getProperties()) {
+      p.second->enableReadStats();
     }
-    nodeList += elm.first;
   }
-  this->publish(Message(topicBase + "$nodes", nodeList));
+}
 
-  for (auto e : nodes) {
-    e.second->introduce();
+void Device::enableStatsNode(unsigned long interval) {
+  enableStats();
+  statsInterval = interval;
+  if (statsNode) {
+    return;
+  }
+  statsNode = create<Node>(this, "stats", "Statistics", "diagnostics");
+  DeviceStats *s = stats.get();
+  struct Field {
+    const char *id;
+    const char *name;
+    const char *unit;
+    DataType type;
+    std::function<std::string()> reader;
+  };
+  Field fields[] = {
+      {"published", "Published", "#", homie::INTEGER,
+       [this]() { return std::to_string(lastStatsPublished); }},
+      {"bytes", "Published bytes", "B", homie::INTEGER,
+       [this]() { return std::to_string(lastStatsBytes); }},
+      {"received", "Received", "#", homie::INTEGER,
+       [s]() { return std::to_string(s->received); }},
+      {"rate", "Publish rate", "msg/s", homie::FLOAT,
+       [this]() { return f2s(publishRate); }},
+      {"read-p99", "Read latency p99", "us", homie::INTEGER,
+       [s]() { return std::to_string(s->readPercentile(99)); }},
+      {"dispatch-p99", "Dispatch latency p99", "us", homie::INTEGER,
+       [s]() { return std::to_string(s->dispatchMicros.percentile(99)); }},
+      {"introduce-max", "Introduction max", "us", homie::INTEGER,
+       [s]() { return std::to_string(s->introduceMicros.getMax()); }}};
+  for (auto &f : fields) {
+    auto p = create<Property>(statsNode, f.id, f.name, f.type, false,
+                              f.reader);
+    p->setUnit(f.unit);
   }
-  this->setLifecycleState(homie::READY);
-  this->publish(getLifecycleMsg());
+}
+
+void Device::publishStats(unsigned long now) {
+  if (!statsNode) {
+    return;
+  }
+  // counts as of now, not including the stats messages themselves
+  if (now > lastStatsAt) {
+    publishRate =
+        (stats->published - lastStatsPublished) * 1000.0f / (now - lastStatsAt);
+  }
+  lastStatsAt = now;
+  lastStatsPublished = stats->published;
+  lastStatsBytes = stats->publishedBytes;
+  for (auto &e : statsNode->getProperties()) {
+    e.second->publish();
+  }
+}
+
+bool Device::isTopologyPublished() {
+  return !publishedFingerprint.empty() &&
+         publishedFingerprint == getFingerprint();
 }
 
 int Device::getWifiSignalStrength() {
@@ -111,23 +549,69 @@ Message Device::getLifecycleMsg() {
   return Message(getLifecycleTopic(), LIFECYCLE_STATES[(int)lifecycleState]);
 }
 
-void Device::onMessage(Message m) {
-  // Extract property and node name from string
-  this->topicElements.clear();
-  split_string(m.topic, "/", this->topicElements);
+bool Device::addSubscription(const std::string &filter, MessageHandler h) {
+  return subscriptions.add(filter, h);
+}
+
+std::vector<std::string> Device::getSubscriptionFilters() {
+  SubscriptionTrie all;
+  MessageHandler none = [](const Message &) {};
+  for (auto &f : subscriptions.minimalFilters()) {
+    all.add(f, none);
+  }
+  all.add(topicBase + "+/+/set", none);
+  all.add(getFingerprintTopic(), none);
+  return all.minimalFilters();
+}
+
+void Device::subscribeAll() {
+  for (auto &f : getSubscriptionFilters()) {
+    this->subscribe(f);
+  }
+}
+
+void Device::onMessage(const Message &m) {
+  if (!stats) {
+    handleMessage(m);
+    return;
+  }
+  uint64_t start = getMicros();
+  handleMessage(m);
+  stats->received++;
+  stats->dispatchMicros.record((uint32_t)(getMicros() - start));
+}
+
+void Device::handleMessage(const Message &m) {
+#ifdef HOMIE_MMAP
+  if (recorder) {
+    recorder->append(LOG_RECEIVED, m);
+  }
+#endif
   // homie/dev/node/prop/set
-  if (this->topicElements.size() == 5) {
-    auto nodeNm = this->topicElements[2];
-    auto propNm = this->topicElements[3];
-    auto node = this->getNode(nodeNm);
-    auto prop = node->getProperty(propNm);
-    if (!prop->isSettable()) {
-      std::cerr << "Ignoring message for non-settable property: " << propNm
-                << std::endl;
+  auto prop = this->findRoute(m.topic);
+  if (prop == nullptr) {
+    if (m.topic == getFingerprintTopic()) {
+      this->publishedFingerprint = m.payload;
+      return;
+    }
+    if (subscriptions.dispatch(m) > 0) {
       return;
     }
-    prop->setValue(m.payload);
+    std::cerr << "Ignoring message for unknown topic: " << m.topic
+              << std::endl;
+    return;
+  }
+  dispatch(prop, m);
+}
+
+void Device::dispatch(Property *prop, const Message &m) {
+  if (!prop->isSettable()) {
+    std::cerr << "Ignoring message for non-settable property: "
+              << prop->getId() << std::endl;
+    return;
   }
+  // rejected commands are counted, see Property::getRejectedCommands
+  prop->command(m.payload);
 }
 
 } // namespace homie
@@ -0,0 +1,124 @@
+#include "homie.hpp"
+namespace homie {
+DeviceRegistry::DeviceRegistry(std::function<void(const Message &)> asink) {
+  sink = asink;
+  introductionHead = 0;
+}
+
+DeviceRegistry::~DeviceRegistry() {
+  introduction.reset();
+  for (auto &e : devices) {
+    delete e.second;
+  }
+}
+
+void DeviceRegistry::reserve(size_t deviceCount, size_t propertyCount) {
+  devices.reserve(deviceCount);
+  routes.reserve(propertyCount);
+}
+
+bool DeviceRegistry::add(Device *d) {
+  if (!devices.emplace(d->getId(), d).second) {
+    return false;
+  }
+  d->setRegistry(this);
+  introductionQueue.push_back(d);
+  return true;
+}
+
+void DeviceRegistry::remove(const std::string &id) {
+  auto search = devices.find(id);
+  if (search == devices.end()) {
+    return;
+  }
+  Device *d = search->second;
+  for (auto &ne : d->getNodes()) {
+    for (auto &pe : ne.second->getProperties()) {
+      routes.erase(pe.second->getSubTopic());
+    }
+  }
+  // drop it from any pending introduction
+  if (introduction && introduction->getDevice() == d) {
+    introduction.reset();
+  }
+  std::replace(introductionQueue.begin() + introductionHead,
+               introductionQueue.end(), d, (Device *)nullptr);
+  devices.erase(search);
+  delete d;
+}
+
+Device *DeviceRegistry::getDevice(const std::string &id) {
+  auto search = devices.find(id);
+  if (search == devices.end()) {
+    return nullptr;
+  }
+  return search->second;
+}
+
+void DeviceRegistry::addRoute(Property *p) { routes[p->getSubTopic()] = p; }
+
+Property *DeviceRegistry::findRoute(const std::string &topic) {
+  auto search = routes.find(topic);
+  if (search == routes.end()) {
+    return nullptr;
+  }
+  return search->second;
+}
+
+void DeviceRegistry::onMessage(const Message &m) {
+  auto prop = findRoute(m.topic);
+  if (prop != nullptr) {
+    prop->getNode()->getDevice()->dispatch(prop, m);
+    return;
+  }
+  // homie/<device id>/... for device attributes such as $fingerprint
+  size_t start = m.topic.find('/');
+  if (start == std::string::npos) {
+    return;
+  }
+  size_t end = m.topic.find('/', start + 1);
+  if (end == std::string::npos) {
+    return;
+  }
+  auto d = getDevice(m.topic.substr(start + 1, end - start - 1));
+  if (d != nullptr) {
+    d->onMessage(m);
+  }
+}
+
+void DeviceRegistry::introduceAll() {
+  introduction.reset();
+  introductionQueue.clear();
+  introductionHead = 0;
+  for (auto &e : devices) {
+    introductionQueue.push_back(e.second);
+  }
+}
+
+size_t DeviceRegistry::introduceSome(size_t max) {
+  size_t n = 0;
+  Message m;
+  while (n < max) {
+    if (!introduction) {
+      while (introductionHead < introductionQueue.size() &&
+             introductionQueue[introductionHead] == nullptr) {
+        introductionHead++;
+      }
+      if (introductionHead == introductionQueue.size()) {
+        introductionQueue.clear();
+        introductionHead = 0;
+        break;
+      }
+      introduction.reset(
+          new Introduction(introductionQueue[introductionHead++]));
+    }
+    if (introduction->next(m)) {
+      introduction->getDevice()->send(m);
+      n++;
+    } else {
+      introduction.reset();
+    }
+  }
+  return n;
+}
+} // namespace homie
@@ -0,0 +1,256 @@
+#include "homie.hpp"
+namespace homie {
+
+/** Whether the len bytes at s spell the literal lit */
+static bool is(const char *s, size_t len, const char *lit) {
+  return strlen(lit) == len && memcmp(s, lit, len) == 0;
+}
+
+/** Index of the len bytes at s in the nullptr-terminated names, or -1 */
+static int find(const char *const *names, const char *s, size_t len) {
+  for (int i = 0; names[i]; i++) {
+    if (is(s, len, names[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// attributes known at each level, in the order the apply functions expect
+static const char *const DEVICE_ATTRS[] = {
+    "$state", "$homie", "$name",       "$nodes", "$implementation",
+    "$localip", "$mac", "$extensions", nullptr};
+static const char *const FW_ATTRS[] = {"name", "version", nullptr};
+static const char *const NODE_ATTRS[] = {"$name", "$type", "$properties",
+                                         nullptr};
+static const char *const PROPERTY_ATTRS[] = {
+    "$name", "$datatype", "$settable", "$retained", "$unit", "$format",
+    nullptr};
+
+/** Replace out with the entries of a comma-separated list */
+static void splitList(const std::string &list, std::vector<std::string> &out) {
+  out.clear();
+  if (list.empty()) {
+    return;
+  }
+  size_t start = 0;
+  for (;;) {
+    size_t comma = list.find(',', start);
+    out.push_back(list.substr(start, comma - start));
+    if (comma == std::string::npos) {
+      return;
+    }
+    start = comma + 1;
+  }
+}
+
+PropertyMirror *NodeMirror::getProperty(const std::string &id) {
+  auto search = properties.find(id);
+  return search == properties.end() ? nullptr : &search->second;
+}
+
+NodeMirror *DeviceMirror::getNode(const std::string &id) {
+  auto search = nodes.find(id);
+  return search == nodes.end() ? nullptr : &search->second;
+}
+
+bool DeviceMirror::isComplete() {
+  if (homie.empty() || name.empty() || nodeIds.empty()) {
+    return false;
+  }
+  for (auto &nid : nodeIds) {
+    NodeMirror *n = getNode(nid);
+    if (!n || n->name.empty() || n->type.empty() || n->propertyIds.empty()) {
+      return false;
+    }
+    for (auto &pid : n->propertyIds) {
+      PropertyMirror *p = n->getProperty(pid);
+      if (!p || p->name.empty() || p->datatype.empty()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+Discovery::Discovery(std::string homieTopicBase) {
+  base = homieTopicBase;
+  ignored = 0;
+}
+
+DeviceMirror *Discovery::getDevice(const std::string &id) {
+  auto search = devices.find(id);
+  return search == devices.end() ? nullptr : &search->second;
+}
+
+DeviceMirror &Discovery::deviceAt(const std::string &topic, size_t pos,
+                                  size_t len) {
+  key.assign(topic, pos, len);
+  DeviceMirror &d = devices[key];
+  if (d.id.empty()) {
+    d.id = key;
+  }
+  return d;
+}
+
+bool Discovery::onMessage(const Message &m) {
+  // homie/dev/$attr, homie/dev/$fw/attr, homie/dev/node/$attr,
+  // homie/dev/node/prop, homie/dev/node/prop/$attr
+  const std::string &t = m.topic;
+  size_t n = base.length();
+  if (t.length() <= n + 1 || t.compare(0, n, base) != 0 || t[n] != '/') {
+    ignored++;
+    return false;
+  }
+  const size_t maxSegments = 4;
+  size_t start[maxSegments], len[maxSegments], count = 0;
+  size_t pos = n + 1;
+  for (;;) {
+    if (count == maxSegments) {
+      ignored++;
+      return false;
+    }
+    size_t slash = t.find('/', pos);
+    size_t end = slash == std::string::npos ? t.length() : slash;
+    if (end == pos) {
+      ignored++;
+      return false;
+    }
+    start[count] = pos;
+    len[count++] = end - pos;
+    if (slash == std::string::npos) {
+      break;
+    }
+    pos = slash + 1;
+  }
+  const char *s = t.data();
+  if (count < 2 || s[start[0]] == '$') {
+    // nothing below the device id, or homie/$broadcast
+    ignored++;
+    return false;
+  }
+  // classify the attribute before touching the model, so that /set
+  // echoes and unknown attributes don't leave empty mirrors behind
+  enum { DEVICE, FIRMWARE, NODE, VALUE, PROPERTY } level = DEVICE;
+  int attr = -1;
+  if (s[start[1]] == '$') {
+    if (count == 2) {
+      attr = find(DEVICE_ATTRS, s + start[1], len[1]);
+    } else if (count == 3 && is(s + start[1], len[1], "$fw")) {
+      level = FIRMWARE;
+      attr = find(FW_ATTRS, s + start[2], len[2]);
+    }
+  } else if (count == 3 && s[start[2]] == '$') {
+    level = NODE;
+    attr = find(NODE_ATTRS, s + start[2], len[2]);
+  } else if (count == 3) {
+    level = VALUE;
+    attr = 0;
+  } else if (count == 4 && s[start[2]] != '$' && s[start[3]] == '$') {
+    level = PROPERTY;
+    attr = find(PROPERTY_ATTRS, s + start[3], len[3]);
+  }
+  if (attr < 0) {
+    ignored++;
+    return false;
+  }
+  DeviceMirror &d = deviceAt(t, start[0], len[0]);
+  if (level == DEVICE) {
+    deviceAttribute(d, attr, m.payload);
+    return true;
+  }
+  if (level == FIRMWARE) {
+    (attr == 0 ? d.fwName : d.fwVersion) = m.payload;
+    return true;
+  }
+  key.assign(t, start[1], len[1]);
+  NodeMirror &node = d.nodes[key];
+  if (node.id.empty()) {
+    node.id = key;
+  }
+  if (level == NODE) {
+    nodeAttribute(node, attr, m.payload);
+    return true;
+  }
+  key.assign(t, start[2], len[2]);
+  PropertyMirror &p = node.properties[key];
+  if (p.id.empty()) {
+    p.id = key;
+  }
+  if (level == VALUE) {
+    p.value = m.payload;
+  } else {
+    propertyAttribute(p, attr, m.payload);
+  }
+  return true;
+}
+
+void Discovery::deviceAttribute(DeviceMirror &d, int attr,
+                                const std::string &payload) {
+  switch (attr) {
+  case 0:
+    d.state = payload;
+    break;
+  case 1:
+    d.homie = payload;
+    break;
+  case 2:
+    d.name = payload;
+    break;
+  case 3:
+    splitList(payload, d.nodeIds);
+    break;
+  case 4:
+    d.implementation = payload;
+    break;
+  case 5:
+    d.localIp = payload;
+    break;
+  case 6:
+    d.mac = payload;
+    break;
+  case 7:
+    splitList(payload, d.extensions);
+    break;
+  }
+}
+
+void Discovery::nodeAttribute(NodeMirror &n, int attr,
+                              const std::string &payload) {
+  switch (attr) {
+  case 0:
+    n.name = payload;
+    break;
+  case 1:
+    n.type = payload;
+    break;
+  case 2:
+    splitList(payload, n.propertyIds);
+    break;
+  }
+}
+
+void Discovery::propertyAttribute(PropertyMirror &p, int attr,
+                                  const std::string &payload) {
+  switch (attr) {
+  case 0:
+    p.name = payload;
+    break;
+  case 1:
+    p.datatype = payload;
+    break;
+  case 2:
+    p.settable = payload == "true";
+    break;
+  case 3:
+    p.retained = payload != "false";
+    break;
+  case 4:
+    p.unit = payload;
+    break;
+  case 5:
+    p.format = payload;
+    break;
+  }
+}
+} // namespace homie
@@ -0,0 +1,56 @@
+#include "homie.hpp"
+namespace homie {
+
+#ifndef NO_MBEDTLS
+Fingerprint::Fingerprint() {
+  mbedtls_sha512_init(&ctx);
+  mbedtls_sha512_starts_ret(&ctx, 0);
+}
+
+Fingerprint::~Fingerprint() { mbedtls_sha512_free(&ctx); }
+
+void Fingerprint::update(const char *data, size_t len) {
+  mbedtls_sha512_update_ret(&ctx, (const unsigned char *)data, len);
+}
+
+std::string Fingerprint::hex() {
+  unsigned char digest[64];
+  mbedtls_sha512_finish_ret(&ctx, digest);
+  static const char digits[] = "0123456789abcdef";
+  std::string s;
+  for (int i = 0; i < 8; i++) {
+    s += digits[digest[i] >> 4];
+    s += digits[digest[i] & 0xf];
+  }
+  return s;
+}
+#else
+Fingerprint::Fingerprint() { hash = 14695981039346656037ULL; }
+
+Fingerprint::~Fingerprint() {}
+
+void Fingerprint::update(const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+}
+
+std::string Fingerprint::hex() {
+  static const char digits[] = "0123456789abcdef";
+  std::string s(16, '0');
+  uint64_t h = hash;
+  for (int i = 15; i >= 0; i--) {
+    s[i] = digits[h & 0xf];
+    h >>= 4;
+  }
+  return s;
+}
+#endif
+
+void Fingerprint::update(const std::string &s) {
+  update(s.c_str(), s.length() + 1);
+}
+
+void Fingerprint::update(bool b) { update(b ? "1" : "0", 1); }
+} // namespace homie
@@ -0,0 +1,112 @@
+#include "homie.hpp"
+namespace homie {
+
+static size_t copyOut(const char *s, size_t n, char *buf, size_t len) {
+  if (n + 1 > len) {
+    if (len > 0) {
+      buf[0] = 0;
+    }
+    return 0;
+  }
+  memcpy(buf, s, n);
+  buf[n] = 0;
+  return n;
+}
+
+/** Render u backwards ending just before end, return the first digit */
+static char *formatDigits(uint64_t u, char *end, int minDigits = 1) {
+  char *p = end;
+  do {
+    *--p = '0' + (char)(u % 10);
+    u /= 10;
+    minDigits--;
+  } while (u > 0 || minDigits > 0);
+  return p;
+}
+
+size_t formatInt(int32_t v, char *buf, size_t len) {
+  char tmp[12];
+  char *end = tmp + sizeof(tmp);
+  // widen first so INT32_MIN negates safely
+  int64_t w = v;
+  char *p = formatDigits(w < 0 ? -w : w, end);
+  if (w < 0) {
+    *--p = '-';
+  }
+  return copyOut(p, end - p, buf, len);
+}
+
+size_t formatFloat(float v, int decimals, char *buf, size_t len) {
+  if (std::isnan(v)) {
+    return copyOut("nan", 3, buf, len);
+  }
+  if (std::isinf(v)) {
+    return v < 0 ? copyOut("-inf", 4, buf, len) : copyOut("inf", 3, buf, len);
+  }
+  if (decimals < 0) {
+    decimals = 0;
+  } else if (decimals > 9) {
+    decimals = 9;
+  }
+  uint64_t scale = 1;
+  for (int i = 0; i < decimals; i++) {
+    scale *= 10;
+  }
+  double x = std::fabs((double)v);
+  if (x * scale >= 1e18) {
+    // beyond fixed-point range; rare enough to leave to the C library
+    char big[64];
+    int n = snprintf(big, sizeof(big), "%.*f", decimals, (double)v);
+    return copyOut(big, n > 0 ? n : 0, buf, len);
+  }
+  char tmp[32];
+  char *end = tmp + sizeof(tmp);
+  char *p = end;
+  uint64_t scaled = (uint64_t)(x * scale + 0.5);
+  if (decimals > 0) {
+    p = formatDigits(scaled % scale, p, decimals);
+    *--p = '.';
+  }
+  p = formatDigits(scaled / scale, p);
+  if (std::signbit(v)) {
+    *--p = '-';
+  }
+  return copyOut(p, end - p, buf, len);
+}
+
+size_t formatBool(bool v, char *buf, size_t len) {
+  return v ? copyOut("true", 4, buf, len) : copyOut("false", 5, buf, len);
+}
+
+size_t formatEnum(unsigned index, const std::string &list, char *buf,
+                  size_t len) {
+  size_t start = 0;
+  for (unsigned i = 0; i < index; i++) {
+    start = list.find(',', start);
+    if (start == std::string::npos) {
+      return copyOut("", 0, buf, len);
+    }
+    start++;
+  }
+  size_t end = list.find(',', start);
+  if (end == std::string::npos) {
+    end = list.length();
+  }
+  return copyOut(list.data() + start, end - start, buf, len);
+}
+
+int enumIndexOf(const std::string &value, const std::string &list) {
+  size_t start = 0;
+  for (int i = 0;; i++) {
+    size_t end = list.find(',', start);
+    size_t n = (end == std::string::npos ? list.length() : end) - start;
+    if (n == value.length() && list.compare(start, n, value) == 0) {
+      return i;
+    }
+    if (end == std::string::npos) {
+      return -1;
+    }
+    start = end + 1;
+  }
+}
+} // namespace homie
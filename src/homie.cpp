@@ -3,14 +3,21 @@
 namespace homie {
 
 const std::string DEGREE_SYMBOL = "°";
-const std::string HOMIE_VERSION = "4.0";
+const std::string HOMIE_VERSION = SPEC_VERSION;
 
 const std::string NODE_NM_WIFI = "wifi";
 const std::string PROP_NM_RSSI = "rssi";
 const std::string PROP_NM_WIFI_SIGNAL = "signal";
 
-std::string DATA_TYPES[] = {"integer", "string", "float",    "percent",
-                            "boolean", "enum",   "dateTime", "duration"};
+std::string DATA_TYPES[] = {
+    DATA_TYPE_NAMES[INTEGER], DATA_TYPE_NAMES[STRING],
+    DATA_TYPE_NAMES[FLOAT],   DATA_TYPE_NAMES[PERCENT],
+    DATA_TYPE_NAMES[BOOLEAN], DATA_TYPE_NAMES[ENUM],
+    DATA_TYPE_NAMES[COLOR],   DATA_TYPE_NAMES[DATETIME],
+    DATA_TYPE_NAMES[DURATION]};
+static_assert(sizeof(DATA_TYPES) / sizeof(DATA_TYPES[0]) ==
+                  sizeof(DATA_TYPE_NAMES) / sizeof(DATA_TYPE_NAMES[0]),
+              "One $datatype name per DataType");
 
 std::string LIFECYCLE_STATES[] = {"init",     "ready", "disconnected",
                                   "sleeping", "lost",  "alert"};
@@ -32,6 +39,11 @@ std::string formatMac(std::string str) {
 
 std::string to_string(bool v) { return std::string(v ? "true" : "false"); }
 
+std::string to_string(int v) {
+  char buf[12];
+  return std::string(buf, formatInt(v, buf, sizeof(buf)));
+}
+
 void split_string(std::string s, std::string delimiter,
                   std::vector<std::string> &res) {
   size_t pos_start = 0, pos_end, delim_len = delimiter.length();
@@ -52,8 +64,7 @@ float to_fahrenheit(float celsius) {
 }
 
 std::string f2s(float f) {
-  char buf[10];
-  sprintf(buf, "%.1f", f);
-  return std::string(buf);
+  char buf[48];
+  return std::string(buf, formatFloat(f, 1, buf, sizeof(buf)));
 }
 } // namespace homie
@@ -0,0 +1,84 @@
+#include "homie.hpp"
+namespace homie {
+Introduction::Introduction(Device *d) {
+  device = d;
+  restart();
+}
+
+void Introduction::restart() {
+  step = 0;
+  valuesOnly = device->isTopologyPublished();
+  if (valuesOnly) {
+    nodeIt = device->getNodes().begin();
+    enterNode();
+  } else {
+    phase = DEVICE_ATTRS;
+  }
+}
+
+void Introduction::enterNode() {
+  step = 0;
+  if (nodeIt == device->getNodes().end()) {
+    phase = valuesOnly ? FINISH : FINGERPRINT;
+  } else {
+    // one bulk read covers all of the node's property values
+    nodeIt->second->sample();
+    if (valuesOnly) {
+      propIt = nodeIt->second->getProperties().begin();
+      phase = PROPERTY_ATTRS;
+    } else {
+      phase = NODE_ATTRS;
+    }
+  }
+}
+
+bool Introduction::next(Message &out) {
+  for (;;) {
+    switch (phase) {
+    case DEVICE_ATTRS:
+      if (device->nextIntroduction(step, out)) {
+        return true;
+      }
+      nodeIt = device->getNodes().begin();
+      enterNode();
+      break;
+    case NODE_ATTRS:
+      if (nodeIt->second->nextIntroduction(step, out)) {
+        return true;
+      }
+      propIt = nodeIt->second->getProperties().begin();
+      step = 0;
+      phase = PROPERTY_ATTRS;
+      break;
+    case PROPERTY_ATTRS:
+      if (propIt == nodeIt->second->getProperties().end()) {
+        ++nodeIt;
+        enterNode();
+      } else if (valuesOnly) {
+        Property *p = propIt->second;
+        ++propIt;
+        if (p->getValueMessage(out)) {
+          return true;
+        }
+      } else if (propIt->second->nextIntroduction(step, out)) {
+        return true;
+      } else {
+        ++propIt;
+        step = 0;
+      }
+      break;
+    case FINGERPRINT:
+      out = Message(device->getFingerprintTopic(), device->getFingerprint());
+      phase = FINISH;
+      return true;
+    case FINISH:
+      device->setLifecycleState(homie::READY);
+      out = device->getLifecycleMsg();
+      phase = DONE;
+      return true;
+    case DONE:
+      return false;
+    }
+  }
+}
+} // namespace homie
@@ -0,0 +1,19 @@
+#include "homie.hpp"
+namespace homie {
+MemoryUsage &MemoryUsage::operator+=(const MemoryUsage &o) {
+  objects += o.objects;
+  strings += o.strings;
+  containers += o.containers;
+  functions += o.functions;
+  return *this;
+}
+
+size_t heapBytes(const std::string &s) {
+  const char *data = s.data();
+  const char *self = (const char *)&s;
+  if (data >= self && data < self + sizeof(s)) {
+    return 0;
+  }
+  return s.capacity() + 1;
+}
+} // namespace homie
@@ -1,5 +1,7 @@
 #include "homie.hpp"
 namespace homie {
+Message::Message() : qos(1), retained(true) {}
+
 Message::Message(std::string topic, std::string payload, bool retained,
                  int qos) {
   this->topic = topic;
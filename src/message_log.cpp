@@ -0,0 +1,271 @@
+#include "homie.hpp"
+#ifdef HOMIE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace homie {
+
+static const char LOG_MAGIC[8] = {'H', 'O', 'M', 'I', 'E', 'L', 'G', '1'};
+static const size_t LOG_INITIAL_MAP = 64 * 1024;
+
+/**
+ * Store and load a record's flags byte with release/acquire ordering. The
+ * byte lives in the file mapping rather than in an object that could be
+ * declared std::atomic, hence std::atomic_ref where C++20 has it and the
+ * equivalent GCC/Clang builtins before that.
+ */
+static void storeFlags(char *p, char f) {
+#if __cplusplus >= 202002L
+  std::atomic_ref<char>(*p).store(f, std::memory_order_release);
+#else
+  __atomic_store_n(p, f, __ATOMIC_RELEASE);
+#endif
+}
+
+static uint8_t loadFlags(const char *p) {
+#if __cplusplus >= 202002L
+  return (uint8_t)std::atomic_ref<char>(*const_cast<char *>(p))
+      .load(std::memory_order_acquire);
+#else
+  return (uint8_t)__atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static char *putVarint(char *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = (char)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (char)v;
+  return p;
+}
+
+/** @return false if the varint runs past end or is too long */
+static bool getVarint(const char *&p, const char *end, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p == end) {
+      return false;
+    }
+    uint8_t b = (uint8_t)*p++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+MessageLog::MessageLog()
+    : fd(-1), map(nullptr), mapped(0), used(0), lastTime(0) {}
+
+MessageLog::~MessageLog() { close(); }
+
+bool MessageLog::open(const std::string &path) {
+  close();
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  used = 0;
+  lastTime = 0;
+  started = std::chrono::steady_clock::now();
+  if (!reserve(sizeof(LOG_MAGIC))) {
+    close();
+    return false;
+  }
+  memcpy(map, LOG_MAGIC, sizeof(LOG_MAGIC));
+  used = sizeof(LOG_MAGIC);
+  return true;
+}
+
+bool MessageLog::reserve(size_t more) {
+  if (used + more <= mapped) {
+    return true;
+  }
+  size_t size = mapped ? mapped : LOG_INITIAL_MAP;
+  while (size < used + more) {
+    size *= 2;
+  }
+  if (ftruncate(fd, size) != 0) {
+    return false;
+  }
+  // remap rather than mremap, which is Linux-only
+  if (map) {
+    munmap(map, mapped);
+  }
+  void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    map = nullptr;
+    mapped = 0;
+    return false;
+  }
+  map = (char *)m;
+  mapped = size;
+  return true;
+}
+
+bool MessageLog::append(LogDirection direction, const Message &m) {
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started);
+  return append((unsigned long)elapsed.count(), direction, m);
+}
+
+bool MessageLog::append(unsigned long now, LogDirection direction,
+                        const Message &m) {
+  if (!map) {
+    return false;
+  }
+  // flags, then at most 10 bytes per varint
+  if (!reserve(1 + 30 + m.topic.length() + m.payload.length())) {
+    return false;
+  }
+  // the body goes in first: until the flags byte is stored the record
+  // reads as the zero tail, so a process crash mid-append never leaves a
+  // torn one. Nothing is synced, so this says nothing about power loss.
+  char *flags = map + used;
+  char *p = flags + 1;
+  p = putVarint(p, now >= lastTime ? now - lastTime : 0);
+  p = putVarint(p, m.topic.length());
+  memcpy(p, m.topic.data(), m.topic.length());
+  p += m.topic.length();
+  p = putVarint(p, m.payload.length());
+  memcpy(p, m.payload.data(), m.payload.length());
+  p += m.payload.length();
+  char f = (char)(0x80 | (direction == LOG_RECEIVED ? 1 : 0) |
+               ((m.qos & 3) << 1) | (m.retained ? 8 : 0));
+  storeFlags(flags, f);
+  used = p - map;
+  if (now > lastTime) {
+    lastTime = now;
+  }
+  return true;
+}
+
+void MessageLog::close() {
+  if (map) {
+    munmap(map, mapped);
+    map = nullptr;
+    mapped = 0;
+  }
+  if (fd >= 0) {
+    if (ftruncate(fd, used) != 0) {
+      std::cerr << "Could not trim message log" << std::endl;
+    }
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+MessageLogReader::MessageLogReader()
+    : fd(-1), map(nullptr), length(0), pos(0), time(0) {}
+
+MessageLogReader::~MessageLogReader() { close(); }
+
+bool MessageLogReader::open(const std::string &path) {
+  close();
+  fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LOG_MAGIC)) {
+    close();
+    return false;
+  }
+  length = st.st_size;
+  void *m = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    close();
+    return false;
+  }
+  map = (const char *)m;
+  if (memcmp(map, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0) {
+    close();
+    return false;
+  }
+  rewind();
+  return true;
+}
+
+void MessageLogReader::close() {
+  if (map) {
+    munmap((void *)map, length);
+    map = nullptr;
+  }
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+  length = 0;
+}
+
+void MessageLogReader::rewind() {
+  pos = sizeof(LOG_MAGIC);
+  time = 0;
+}
+
+bool MessageLogReader::next(LogRecord &out) {
+  if (!map || pos >= length) {
+    return false;
+  }
+  // pairs with the release store in MessageLog::append
+  uint8_t flags = loadFlags(map + pos);
+  if (!(flags & 0x80)) {
+    return false;
+  }
+  const char *p = map + pos + 1, *end = map + length;
+  uint64_t delta, topicLen, payloadLen;
+  if (!getVarint(p, end, delta) || !getVarint(p, end, topicLen) ||
+      (uint64_t)(end - p) < topicLen) {
+    return false;
+  }
+  const char *topic = p;
+  p += topicLen;
+  if (!getVarint(p, end, payloadLen) || (uint64_t)(end - p) < payloadLen) {
+    return false;
+  }
+  time += delta;
+  out.time = time;
+  out.direction = flags & 1 ? LOG_RECEIVED : LOG_PUBLISHED;
+  out.message.topic.assign(topic, topicLen);
+  out.message.payload.assign(p, payloadLen);
+  out.message.qos = (flags >> 1) & 3;
+  out.message.retained = (flags & 8) != 0;
+  pos = p + payloadLen - map;
+  return true;
+}
+
+size_t MessageLogReader::replay(Device &d,
+                                std::function<void(const Message &)> published,
+                                double speed) {
+  auto start = std::chrono::steady_clock::now();
+  bool first = true;
+  unsigned long base = 0;
+  size_t n = 0;
+  LogRecord r;
+  while (next(r)) {
+    if (first) {
+      base = r.time;
+      first = false;
+    }
+    if (speed > 0) {
+      std::this_thread::sleep_until(
+          start + std::chrono::microseconds(
+                      (long long)((r.time - base) * 1000 / speed)));
+    }
+    if (r.direction == LOG_RECEIVED) {
+      d.onMessage(r.message);
+    } else if (published) {
+      published(r.message);
+    }
+    n++;
+  }
+  return n;
+}
+} // namespace homie
+#endif
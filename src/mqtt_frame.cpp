@@ -0,0 +1,76 @@
+#include "homie.hpp"
+namespace homie {
+
+const size_t MqttEncoder::MAX_REMAINING;
+
+/** Bytes of the variable byte integer for n */
+static size_t varintSize(size_t n) {
+  return n < 128 ? 1 : n < 16384 ? 2 : n < 2097152 ? 3 : 4;
+}
+
+size_t MqttEncoder::frameSize(size_t topicLen, size_t payloadLen, int qos) {
+  if (topicLen > 0xffff || payloadLen > MAX_REMAINING) {
+    return 0;
+  }
+  size_t remaining = 2 + topicLen + (qos > 0 ? 2 : 0) + payloadLen;
+  if (remaining > MAX_REMAINING) {
+    return 0;
+  }
+  return 1 + varintSize(remaining) + remaining;
+}
+
+size_t MqttEncoder::encode(const char *topic, size_t topicLen,
+                           const char *payload, size_t payloadLen, int qos,
+                           bool retained, char *buf, size_t len,
+                           uint16_t *packetId) {
+  size_t total = frameSize(topicLen, payloadLen, qos);
+  if (total == 0 || total > len || qos < 0 || qos > 2) {
+    return 0;
+  }
+  char *p = buf;
+  // fixed header: type 3, DUP 0, QoS, RETAIN
+  *p++ = (char)(0x30 | (qos << 1) | (retained ? 1 : 0));
+  size_t remaining = 2 + topicLen + (qos > 0 ? 2 : 0) + payloadLen;
+  do {
+    uint8_t b = remaining % 128;
+    remaining /= 128;
+    *p++ = (char)(remaining > 0 ? b | 0x80 : b);
+  } while (remaining > 0);
+  *p++ = (char)(topicLen >> 8);
+  *p++ = (char)(topicLen & 0xff);
+  memcpy(p, topic, topicLen);
+  p += topicLen;
+  uint16_t id = 0;
+  if (qos > 0) {
+    id = nextPacketId++;
+    if (nextPacketId == 0) {
+      nextPacketId = 1;
+    }
+    *p++ = (char)(id >> 8);
+    *p++ = (char)(id & 0xff);
+  }
+  if (packetId) {
+    *packetId = id;
+  }
+  if (payloadLen > 0) {
+    memcpy(p, payload, payloadLen);
+  }
+  return total;
+}
+
+size_t MqttEncoder::encode(const Message &m, char *buf, size_t len,
+                           uint16_t *packetId) {
+  return encode(m.topic.data(), m.topic.length(), m.payload.data(),
+                m.payload.length(), m.qos, m.retained, buf, len, packetId);
+}
+
+bool MqttBatch::add(const Message &m, uint16_t *packetId) {
+  size_t n = encoder.encode(m, buf + used, capacity - used, packetId);
+  if (n == 0) {
+    return false;
+  }
+  used += n;
+  frames++;
+  return true;
+}
+} // namespace homie
@@ -7,34 +7,131 @@ Node::Node(Device *d, std::string aid, std::string aname,
   name = aname;
   type = nodeType;
   topicBase = device->getTopicBase() + id + "/";
+  snapshotMode = SNAPSHOT_NONE;
+  snapshotEncoding = SNAPSHOT_JSON;
   device->addNode(this);
 }
 
 void Node::addProperty(Property *p) {
   if (p) {
     properties[p->getId()] = p;
+    device->addRoute(p);
+    if (device->getStats()) {
+      p->enableReadStats();
+    }
   }
 }
 
-void Node::introduce() {
+bool Node::nextIntroduction(unsigned &step, Message &out) {
   // homie/super-car/engine/$name → "Car engine"
   // homie/super-car/engine/$type → "V8"
   // homie/super-car/engine/$properties → "speed,direction,temperature"
-  this->device->publish(Message(topicBase + "$name", name));
-  this->device->publish(Message(topicBase + "$type", type));
   std::string propList;
   int i = 0;
-  for (auto e : properties) {
-    if (i++ > 0)
-      propList += ',';
-    propList += e.first;
+  switch (step++) {
+  case 0:
+    out = Message(topicBase + "$name", name);
+    return true;
+  case 1:
+    out = Message(topicBase + "$type", type);
+    return true;
+  case 2:
+    for (auto &e : properties) {
+      if (i++ > 0)
+        propList += ',';
+      propList += e.first;
+    }
+    out = Message(topicBase + "$properties", propList);
+    return true;
+  default:
+    return false;
+  }
+}
+
+void Node::sample() {
+  if (bulkReader) {
+    bulkReader(this);
+  }
+}
+
+void Node::publish(int qos) {
+  sample();
+  for (auto &e : properties) {
+    if (snapshotMode == SNAPSHOT_ONLY) {
+      e.second->refreshValue();
+    } else {
+      e.second->publish(qos);
+    }
+  }
+  if (snapshotMode != SNAPSHOT_NONE) {
+    publishSnapshot(qos);
+  }
+}
+
+size_t Node::publishIfChanged(unsigned long now, int qos) {
+  sample();
+  size_t n = 0;
+  for (auto &e : properties) {
+    bool changed = snapshotMode == SNAPSHOT_ONLY
+                       ? e.second->refreshIfChanged(now)
+                       : e.second->publishIfChanged(now, qos);
+    if (changed) {
+      n++;
+    }
+  }
+  if (n == 0 || snapshotMode == SNAPSHOT_NONE) {
+    return n;
+  }
+  publishSnapshot(qos);
+  return snapshotMode == SNAPSHOT_ONLY ? 1 : n + 1;
+}
+
+const std::string &Node::encodeSnapshot() {
+  SnapshotWriter w(snapshotBuffer, snapshotEncoding);
+  w.begin(properties.size());
+  char buf[PropertyValue::RENDER];
+  for (auto &e : properties) {
+    Property *p = e.second;
+    size_t len;
+    const char *v = p->getStoredValue().view(buf, len);
+    w.field(e.first, p->getDataType(), v, len);
+  }
+  w.end();
+  return snapshotBuffer;
+}
+
+void Node::publishSnapshot(int qos) {
+  device->send(Message(getSnapshotTopic(), encodeSnapshot(), true, qos));
+}
+
+void Node::introduce() {
+  sample();
+  Message m;
+  unsigned step = 0;
+  while (nextIntroduction(step, m)) {
+    this->device->send(m);
   }
-  this->device->publish(Message(topicBase + "$properties", propList));
   for (auto e : properties) {
     e.second->introduce();
   }
 }
 
+MemoryUsage Node::memoryUsage() {
+  MemoryUsage u;
+  u.objects = sizeof(*this);
+  u.functions = sizeof(bulkReader);
+  u.objects -= u.functions;
+  u.strings = heapBytes(id) + heapBytes(name) + heapBytes(type) +
+              heapBytes(topicBase) + heapBytes(psk) + heapBytes(identity) +
+              heapBytes(snapshotBuffer);
+  for (auto &e : properties) {
+    u.containers += mapNodeBytes(sizeof(e));
+    u.strings += heapBytes(e.first);
+    u += e.second->memoryUsage();
+  }
+  return u;
+}
+
 Property *Node::getProperty(std::string nm) {
   auto search = properties.find(nm);
   if (search == properties.end()) {
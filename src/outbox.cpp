@@ -0,0 +1,78 @@
+#include "homie.hpp"
+namespace homie {
+Outbox::Outbox(size_t acapacity, unsigned long messagesPerSec,
+               unsigned long bytesPerSec, bool acoalescing)
+    : ring(acapacity > 0 ? acapacity : 1), keys(ring.size(), nullptr),
+      coalescing(acoalescing), head(0), count(0), highWater(0), dropped(0),
+      sent(0), coalesced(0), messageBudget(messagesPerSec),
+      byteBudget(bytesPerSec) {
+  if (coalescing) {
+    pending.reserve(ring.size());
+  }
+}
+
+MemoryUsage Outbox::memoryUsage() {
+  MemoryUsage u;
+  u.containers = ring.size() * (sizeof(Message) + sizeof(const void *)) +
+                 pending.size() * hashNodeBytes(sizeof(const void *) +
+                                                sizeof(size_t)) +
+                 pending.bucket_count() * sizeof(void *);
+  for (auto &m : ring) {
+    u.strings += heapBytes(m.topic) + heapBytes(m.payload);
+  }
+  return u;
+}
+
+bool Outbox::push(const Message &m, const void *key) {
+  if (!coalescing) {
+    key = nullptr;
+  }
+  if (key) {
+    auto search = pending.find(key);
+    if (search != pending.end()) {
+      ring[search->second] = m;
+      coalesced++;
+      return true;
+    }
+  }
+  if (count == ring.size()) {
+    dropped++;
+    return false;
+  }
+  size_t slot = (head + count) % ring.size();
+  ring[slot] = m;
+  keys[slot] = key;
+  if (key) {
+    pending[key] = slot;
+  }
+  count++;
+  if (count > highWater) {
+    highWater = count;
+  }
+  return true;
+}
+
+bool Outbox::pop(unsigned long now, Message &out) {
+  if (count == 0) {
+    return false;
+  }
+  Message &m = ring[head];
+  unsigned long bytes = m.topic.length() + m.payload.length();
+  messageBudget.refill(now);
+  byteBudget.refill(now);
+  if (!messageBudget.canTake(1) || !byteBudget.canTake(bytes)) {
+    return false;
+  }
+  messageBudget.take(1);
+  byteBudget.take(bytes);
+  out = std::move(m);
+  if (keys[head]) {
+    pending.erase(keys[head]);
+    keys[head] = nullptr;
+  }
+  head = (head + 1) % ring.size();
+  count--;
+  sent++;
+  return true;
+}
+} // namespace homie
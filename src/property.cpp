@@ -2,21 +2,24 @@
 namespace homie {
 Property::Property(Node *anode, std::string aid, std::string aname,
                    DataType aDataType, bool asettable,
-                   std::function<std::string(void)> areaderFunc) {
-  id = aid;
-  name = aname;
+                   std::function<std::string(void)> areaderFunc)
+    : id(aid), name(aname), format(std::string()), unit(format) {
   node = anode;
   dataType = aDataType;
   settable = asettable;
-  pubTopic = node->getTopicBase() + this->id;
-  subTopic = node->getTopicBase() + this->id + "/set";
+  if (settable) {
+    commands.reset(new CommandState());
+    commands->format = ValueFormat(dataType, format.get());
+  }
   node->addProperty(this);
   this->retained = true;
-  this->hasWriterFunc = false;
+  this->valuePublished = false;
+  this->lastPublished = 0;
+  this->sampleInterval = 0;
   this->readerFunc = areaderFunc;
 }
 
-void Property::introduce() {
+bool Property::nextIntroduction(unsigned &step, Message &out) {
   // The validator fails unless there's a value message posted
   // before the metadata attributes
   // homie/super-car/engine/temperature → "21.5"
@@ -25,39 +28,410 @@ void Property::introduce() {
   // homie/super-car/engine/temperature/$datatype → "float"
   // homie/super-car/engine/temperature/$unit → "°C"
   // homie/super-car/engine/temperature/$format → "-20:120"
-  this->node->getDevice()->publish(Message(pubTopic + "/$name", name));
-  this->node->getDevice()->publish(
-      Message(pubTopic + "/$settable", settable ? "true" : "false"));
-  this->node->getDevice()->publish(
-      Message(pubTopic + "/$datatype", DATA_TYPES[(int)dataType]));
-  if (unit.length() > 0) {
-    this->node->getDevice()->publish(Message(pubTopic + "/$unit", unit));
+  for (;;) {
+    switch (step++) {
+    case 0:
+      out = Message(topic("/$name"), *name);
+      return true;
+    case 1:
+      out = Message(topic("/$settable"), settable ? "true" : "false");
+      return true;
+    case 2:
+      out = Message(topic("/$datatype"), DATA_TYPES[(int)dataType]);
+      return true;
+    case 3:
+      if (unit->length() > 0) {
+        out = Message(topic("/$unit"), *unit);
+        return true;
+      }
+      break;
+    case 4:
+      if (format->length() > 0) {
+        out = Message(topic("/$format"), *format);
+        return true;
+      }
+      break;
+    case 5:
+      if (getValueMessage(out)) {
+        return true;
+      }
+      break;
+    default:
+      return false;
+    }
   }
-  if (format.length() > 0) {
-    this->node->getDevice()->publish(Message(pubTopic + "/$format", format));
+}
+
+std::string Property::topic(const char *suffix) {
+  const std::string &base = this->node->getTopicBase();
+  size_t n = strlen(suffix);
+  std::string t;
+  t.reserve(base.size() + id->size() + n);
+  t.append(base).append(*id).append(suffix, n);
+  return t;
+}
+
+std::string Property::getPubTopic() { return topic(""); }
+
+std::string Property::getSubTopic() { return topic("/set"); }
+
+void Property::introduce() {
+  Message m;
+  unsigned step = 0;
+  while (nextIntroduction(step, m)) {
+    this->node->getDevice()->send(m);
+  }
+}
+
+bool Property::getValueMessage(Message &out, int qos) {
+#ifdef HOMIE_THREADS
+  if (asyncRead) {
+    // don't block; a fresh value follows once the read completes
+    startRead(this->node->getDevice()->getLastTick());
+    if (this->value.empty()) {
+      // an empty retained message would clear the broker's copy
+      return false;
+    }
+    this->valuePublished = true;
+    this->lastPublished = this->node->getDevice()->getLastTick();
+    out = Message(this->getPubTopic(), this->value.str(), this->retained,
+                  qos);
+    return true;
   }
-  this->publish();
+#endif
+  out = Message(this->getPubTopic(), refreshValue(), this->retained, qos);
+  return true;
+}
+
+std::string Property::refreshValue() {
+  std::string v = readCurrent();
+  this->value.assign(v);
+  this->valuePublished = true;
+  // heartbeats count from any publication, on the device's tick clock
+  this->lastPublished = this->node->getDevice()->getLastTick();
+  return v;
+}
+
+bool Property::refreshIfChanged(unsigned long now) {
+  return acceptValue(readCurrent(), now);
 }
 
 void Property::publish(int qos) {
-  Message m(this->getPubTopic(), this->readerFunc(), qos, this->retained);
-  this->node->getDevice()->publish(m);
+  Message m;
+  if (getValueMessage(m, qos)) {
+    this->node->getDevice()->send(m, this->retained ? this : nullptr);
+  }
+}
+
+bool Property::isChanged(const std::string &v, unsigned long now) {
+  if (!valuePublished) {
+    return true;
+  }
+  if (policy.heartbeat > 0 && now - lastPublished >= policy.heartbeat) {
+    return true;
+  }
+  if (isNumeric()) {
+    char *newEnd;
+    double oldVal;
+    double newVal = strtod(v.c_str(), &newEnd);
+    if (value.toDouble(oldVal) && newEnd != v.c_str()) {
+      double delta = std::fabs(newVal - oldVal);
+      return delta > policy.absoluteDeadband &&
+             delta > policy.relativeDeadband * std::fabs(oldVal);
+    }
+  }
+  return !value.equals(v);
+}
+
+bool Property::publishIfChanged(unsigned long now, int qos) {
+#ifdef HOMIE_THREADS
+  if (asyncRead) {
+    startRead(now);
+    return false;
+  }
+#endif
+  return offerValue(readCurrent(), now, qos);
+}
+
+std::string Property::readCurrent() {
+  if (this->node->hasBulkReader()) {
+    return sampled.str();
+  }
+  if (!readLatency) {
+    return this->readerFunc();
+  }
+  Device *d = this->node->getDevice();
+  uint64_t start = d->getMicros();
+  std::string v = this->readerFunc();
+  uint32_t elapsed = (uint32_t)(d->getMicros() - start);
+  readLatency->record(elapsed);
+  if (DeviceStats *stats = d->getStats()) {
+    stats->recordRead(elapsed);
+  }
+  return v;
+}
+
+void Property::enableReadStats() {
+  if (!readLatency) {
+    readLatency.reset(new Log2Histogram());
+  }
+}
+
+bool Property::acceptValue(const std::string &v, unsigned long now) {
+  if (!isChanged(v, now)) {
+    return false;
+  }
+  this->value.assign(v);
+  this->valuePublished = true;
+  this->lastPublished = now;
+  return true;
+}
+
+bool Property::offerValue(const std::string &v, unsigned long now, int qos) {
+  if (!acceptValue(v, now)) {
+    return false;
+  }
+  this->node->getDevice()->send(
+      Message(this->getPubTopic(), v, this->retained, qos),
+      this->retained ? this : nullptr);
+  return true;
+}
+
+MemoryUsage Property::memoryUsage() {
+  MemoryUsage u;
+  u.functions = sizeof(readerFunc);
+  u.objects = getObjectSize() - u.functions;
+  if (commands) {
+    u.functions += sizeof(commands->writer);
+    u.objects += sizeof(CommandState) - sizeof(commands->writer);
+    if (commands->limiter) {
+      u.objects += sizeof(CommandLimiter);
+    }
+    u.containers += commands->format.heapBytes();
+  }
+  if (readLatency) {
+    u.objects += sizeof(Log2Histogram);
+  }
+  // id, name, unit and format are shared, see StringTable::memoryUsage
+  u.strings = value.heapBytes() + sampled.heapBytes();
+  return u;
 }
+
+void Property::setSampleInterval(unsigned long interval) {
+  this->sampleInterval = interval;
+  this->node->getDevice()->getScheduler().schedule(this);
+}
+
+void Property::setFormat(std::string f) {
+  format = InternedString(f);
+  if (commands) {
+    commands->format = ValueFormat(dataType, format.get());
+  }
+}
+
 void Property::setWriterFunc(std::function<void(std::string)> f) {
-  this->writerFunc = f;
-  this->hasWriterFunc = true;
+  if (!commands) {
+    return;
+  }
+  if (!f) {
+    commands->writer = nullptr;
+    return;
+  }
+  commands->writer = [f](const std::string &v, const CommandValue *) {
+    f(v);
+  };
+}
+
+void Property::setTypedWriter(std::function<void(const CommandValue &)> f) {
+  if (!commands) {
+    return;
+  }
+  commands->writer = [f](const std::string &, const CommandValue *parsed) {
+    if (parsed) {
+      f(*parsed);
+    }
+  };
+}
+
+void Property::write(const std::string &v, const CommandValue *parsed) {
+  this->value.assign(v);
+  this->valuePublished = false;
+  if (parsed) {
+    onCommand(*parsed);
+  }
+  if (commands->writer) {
+    commands->writer(v, parsed);
+  }
 }
 
 void Property::setValue(std::string v) {
-  this->value = v;
-  if (this->settable && this->hasWriterFunc) {
-    this->writerFunc(v);
+  if (!this->settable) {
+    this->value.assign(v);
+    this->valuePublished = false;
+    return;
   }
+  CommandValue parsed;
+  bool ok = commands->format.parse(v, parsed);
+  write(v, ok ? &parsed : nullptr);
+}
+
+bool Property::command(const std::string &payload) {
+  if (!commands) {
+    // not settable
+    return false;
+  }
+  CommandValue parsed;
+  if (!commands->format.parse(payload, parsed)) {
+    commands->rejected++;
+    return false;
+  }
+  CommandLimiter *l = limiter();
+  if (l) {
+    switch (l->offer(payload, parsed, node->getDevice()->getLastTick())) {
+    case CommandLimiter::DEFER:
+      node->getDevice()->awaitCommand(this);
+      return true;
+    case CommandLimiter::WRITE:
+      break;
+    }
+  }
+  write(payload, &parsed);
+  return true;
+}
+
+void Property::setCommandPolicy(const CommandPolicy &p) {
+  if (!commands) {
+    return;
+  }
+  if (p.minInterval == 0 && p.debounce == 0 && p.maxRate == 0) {
+    commands->limiter.reset();
+  } else {
+    commands->limiter.reset(new CommandLimiter(p));
+  }
+}
+
+bool Property::pollCommand(unsigned long now) {
+  CommandLimiter *l = limiter();
+  if (!l) {
+    return true;
+  }
+  std::string v;
+  CommandValue parsed;
+  if (l->poll(now, v, parsed)) {
+    write(v, &parsed);
+  }
+  return !l->hasPending();
 }
 
 std::string Property::read() {
-  this->setValue(this->readerFunc());
+#ifdef HOMIE_THREADS
+  if (asyncRead) {
+    startRead(this->node->getDevice()->getLastTick());
+    return this->getValue();
+  }
+#endif
+  this->setValue(readCurrent());
   return this->getValue();
 }
 
+#ifdef HOMIE_THREADS
+void Property::setAsyncReader(AsyncReaderFunc f, unsigned long timeout) {
+  asyncRead = std::make_shared<AsyncRead>(f, timeout);
+}
+
+void Property::setAsyncReader(WorkerPool &pool, unsigned long timeout) {
+  asyncRead = std::make_shared<AsyncRead>(nullptr, timeout);
+  asyncRead->pool = &pool;
+  // workers get a copy of the reader, never the property itself
+  asyncRead->reader = this->readerFunc;
+}
+
+void Property::startRead(unsigned long now) {
+  std::shared_ptr<AsyncRead> state = asyncRead;
+  {
+    std::lock_guard<std::mutex> guard(state->lock);
+    if (state->awaiting) {
+      return;
+    }
+    state->awaiting = true;
+    state->startedAt = now;
+    this->node->getDevice()->awaitRead(this);
+    if (state->running) {
+      // an earlier read that timed out is still going; take its result
+      return;
+    }
+    state->running = true;
+    state->ready = false;
+  }
+  if (state->pool) {
+    // timed on the worker, recorded by pollRead on the polling thread. The
+    // worker may outlive the device, so it keeps its own clock.
+    state->pool->submit([state]() {
+      auto start = std::chrono::steady_clock::now();
+      std::string v = state->reader();
+      uint32_t elapsed =
+          (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+      std::lock_guard<std::mutex> guard(state->lock);
+      state->result.swap(v);
+      state->micros = elapsed;
+      state->timed = true;
+      state->ready = true;
+      state->running = false;
+    });
+    return;
+  }
+  state->start([state](std::string v) {
+    std::lock_guard<std::mutex> guard(state->lock);
+    state->result = v;
+    state->timed = false;
+    state->ready = true;
+    state->running = false;
+  });
+}
+
+bool Property::pollRead(unsigned long now, int qos) {
+  std::string v;
+  bool timed = false;
+  uint32_t elapsed = 0;
+  {
+    std::lock_guard<std::mutex> guard(asyncRead->lock);
+    if (!asyncRead->awaiting) {
+      return true;
+    }
+    if (asyncRead->ready) {
+      v.swap(asyncRead->result);
+      asyncRead->ready = false;
+      timed = asyncRead->timed;
+      elapsed = asyncRead->micros;
+    } else if (now - asyncRead->startedAt >= asyncRead->timeout) {
+      asyncRead->timeouts++;
+      if (this->value.empty()) {
+        // nothing to fall back to; the late result is taken next time
+        asyncRead->awaiting = false;
+        return true;
+      }
+      v = this->value.str();
+    } else {
+      return false;
+    }
+    asyncRead->awaiting = false;
+  }
+  if (timed && readLatency) {
+    readLatency->record(elapsed);
+    if (DeviceStats *stats = this->node->getDevice()->getStats()) {
+      stats->recordRead(elapsed);
+    }
+  }
+  offerValue(v, now, qos);
+  return true;
+}
+
+unsigned long Property::getReadTimeouts() {
+  std::lock_guard<std::mutex> guard(asyncRead->lock);
+  return asyncRead->timeouts;
+}
+#endif
+
 } // namespace homie
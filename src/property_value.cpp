@@ -0,0 +1,206 @@
+#include "homie.hpp"
+namespace homie {
+PropertyValue::PropertyValue(const PropertyValue &o) : kind(EMPTY), aux(0) {
+  *this = o;
+}
+
+PropertyValue &PropertyValue::operator=(const PropertyValue &o) {
+  if (this == &o) {
+    return *this;
+  }
+  if (o.kind == LONG) {
+    size_t len;
+    const char *s = o.text(len);
+    assign(s, len);
+  } else {
+    release();
+    memcpy(data, o.data, INLINE);
+    kind = o.kind;
+    aux = o.aux;
+  }
+  return *this;
+}
+
+void PropertyValue::release() {
+  if (kind == LONG) {
+    char *p;
+    memcpy(&p, data, sizeof(p));
+    delete[] p;
+  }
+  kind = EMPTY;
+}
+
+/**
+ * Parse the canonical decimal text a formatter would produce: no sign but
+ * '-', no leading zeros, no exponent and at most 18 digits. Anything else
+ * would not format back the same.
+ */
+static bool parseDecimal(const char *s, size_t len, int64_t &m,
+                         uint8_t &decimals) {
+  size_t i = 0;
+  bool neg = len > 0 && s[0] == '-';
+  if (neg) {
+    i++;
+  }
+  if (i + 1 < len && s[i] == '0' && s[i + 1] != '.') {
+    return false;
+  }
+  int digits = 0;
+  bool dot = false;
+  m = 0;
+  decimals = 0;
+  for (; i < len; i++) {
+    char c = s[i];
+    if (c == '.') {
+      if (dot || digits == 0) {
+        return false;
+      }
+      dot = true;
+    } else if (c < '0' || c > '9' || ++digits > 18) {
+      return false;
+    } else {
+      m = m * 10 + (c - '0');
+      decimals += dot;
+    }
+  }
+  if (digits == 0 || (dot && decimals == 0) || (neg && m == 0)) {
+    return false;
+  }
+  if (neg) {
+    m = -m;
+  }
+  return true;
+}
+
+void PropertyValue::assign(const char *s, size_t len) {
+  if (len == 4 && memcmp(s, "true", 4) == 0) {
+    release();
+    data[0] = 1;
+    kind = BOOL;
+    return;
+  }
+  if (len == 5 && memcmp(s, "false", 5) == 0) {
+    release();
+    data[0] = 0;
+    kind = BOOL;
+    return;
+  }
+  int64_t m;
+  uint8_t decimals;
+  if (parseDecimal(s, len, m, decimals)) {
+    release();
+    memcpy(data, &m, sizeof(m));
+    kind = decimals ? FLOAT : INT;
+    aux = decimals;
+    return;
+  }
+  if (len <= INLINE) {
+    release();
+    memcpy(data, s, len);
+    kind = SHORT;
+    aux = (uint8_t)len;
+    return;
+  }
+  char *p = new char[len];
+  memcpy(p, s, len);
+  release();
+  uint32_t n = (uint32_t)len;
+  memcpy(data, &p, sizeof(p));
+  memcpy(data + sizeof(p), &n, sizeof(n));
+  kind = LONG;
+}
+
+size_t PropertyValue::render(char *buf) const {
+  if (kind == BOOL) {
+    strcpy(buf, data[0] ? "true" : "false");
+    return data[0] ? 4 : 5;
+  }
+  int64_t m;
+  memcpy(&m, data, sizeof(m));
+  // digits in reverse, then the sign
+  char rev[24];
+  size_t n = 0;
+  uint64_t u = m < 0 ? -(uint64_t)m : (uint64_t)m;
+  unsigned decimals = kind == FLOAT ? aux : 0;
+  do {
+    if (n == decimals && n > 0) {
+      rev[n++] = '.';
+    }
+    rev[n++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u > 0 || n <= decimals);
+  if (m < 0) {
+    rev[n++] = '-';
+  }
+  for (size_t i = 0; i < n; i++) {
+    buf[i] = rev[n - 1 - i];
+  }
+  buf[n] = 0;
+  return n;
+}
+
+const char *PropertyValue::text(size_t &len) const {
+  if (kind == LONG) {
+    const char *p;
+    uint32_t n;
+    memcpy(&p, data, sizeof(p));
+    memcpy(&n, data + sizeof(p), sizeof(n));
+    len = n;
+    return p;
+  }
+  len = kind == SHORT ? aux : 0;
+  return data;
+}
+
+const char *PropertyValue::view(char *buf, size_t &len) const {
+  if (kind == SHORT || kind == LONG || kind == EMPTY) {
+    return text(len);
+  }
+  len = render(buf);
+  return buf;
+}
+
+std::string PropertyValue::str() const {
+  char buf[RENDER];
+  size_t len;
+  const char *s = view(buf, len);
+  return std::string(s, len);
+}
+
+bool PropertyValue::equals(const std::string &s) const {
+  char buf[RENDER];
+  size_t len;
+  const char *p = view(buf, len);
+  return len == s.size() && memcmp(p, s.data(), len) == 0;
+}
+
+bool PropertyValue::toDouble(double &d) const {
+  switch (kind) {
+  case INT:
+  case FLOAT: {
+    int64_t m;
+    memcpy(&m, data, sizeof(m));
+    // powers of ten up to 1e22 are exact, so this rounds only once
+    d = (double)m / std::pow(10.0, kind == FLOAT ? aux : 0);
+    return true;
+  }
+  case SHORT:
+  case LONG: {
+    std::string s = str();
+    char *end;
+    d = strtod(s.c_str(), &end);
+    return end != s.c_str();
+  }
+  default:
+    return false;
+  }
+}
+
+size_t PropertyValue::heapBytes() const {
+  size_t len = 0;
+  if (kind == LONG) {
+    text(len);
+  }
+  return len;
+}
+} // namespace homie
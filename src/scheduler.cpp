@@ -0,0 +1,124 @@
+#include "homie.hpp"
+namespace homie {
+Scheduler::Scheduler(size_t aslots, unsigned long aresolution) {
+  slotCount = aslots > 0 ? aslots : 1;
+  resolution = aresolution > 0 ? aresolution : 1;
+  lastTick = 0;
+  started = false;
+}
+
+MemoryUsage Scheduler::memoryUsage() {
+  MemoryUsage u;
+  u.containers =
+      entries.capacity() * sizeof(Entry) + slots.capacity() * sizeof(int) +
+      (pending.capacity() + relink.capacity()) * sizeof(int) +
+      index.size() * hashNodeBytes(sizeof(Property *) + sizeof(int)) +
+      index.bucket_count() * sizeof(void *);
+  return u;
+}
+
+void Scheduler::link(int e) {
+  size_t s = slotOf(entries[e].due);
+  entries[e].next = slots[s];
+  slots[s] = e;
+}
+
+void Scheduler::unlink(int e) {
+  int *link = &slots[slotOf(entries[e].due)];
+  while (*link != -1) {
+    if (*link == e) {
+      *link = entries[e].next;
+      return;
+    }
+    link = &entries[*link].next;
+  }
+}
+
+void Scheduler::schedule(Property *p) {
+  if (slots.empty()) {
+    slots.assign(slotCount, -1);
+  }
+  auto search = index.find(p);
+  int e;
+  if (search == index.end()) {
+    if (p->getSampleInterval() == 0) {
+      return;
+    }
+    e = (int)entries.size();
+    entries.push_back(Entry{p, 0, -1, false});
+    index[p] = e;
+  } else {
+    e = search->second;
+    if (entries[e].active) {
+      unlink(e);
+      entries[e].active = false;
+    }
+    if (p->getSampleInterval() == 0) {
+      return;
+    }
+  }
+  pending.push_back(e);
+}
+
+void Scheduler::collect(size_t slot, unsigned long now,
+                        std::vector<Property *> &due) {
+  int *link = &slots[slot];
+  while (*link != -1) {
+    int e = *link;
+    Entry &entry = entries[e];
+    // signed distance copes with clock wrap-around
+    if ((long)(now - entry.due) < 0) {
+      link = &entry.next;
+      continue;
+    }
+    *link = entry.next;
+    due.push_back(entry.prop);
+    unsigned long interval = entry.prop->getSampleInterval();
+    entry.due += interval;
+    if ((long)(now - entry.due) >= 0) {
+      // fell behind; keep the phase but drop the missed samples
+      entry.due = now + interval - (now - entry.due) % interval;
+    }
+    // relink after the pass, so it isn't found again in this tick
+    relink.push_back(e);
+  }
+}
+
+void Scheduler::tick(unsigned long now, std::vector<Property *> &due) {
+  if (slots.empty()) {
+    return;
+  }
+  for (int e : pending) {
+    Entry &entry = entries[e];
+    unsigned long interval = entry.prop->getSampleInterval();
+    if (!entry.active && interval > 0) {
+      // properties sharing a bulk reader are staggered as a group
+      Node *node = entry.prop->getNode();
+      size_t h = node->hasBulkReader()
+                     ? std::hash<std::string>()(node->getTopicBase())
+                     : std::hash<std::string>()(entry.prop->getPubTopic());
+      entry.due = now + h % interval;
+      entry.active = true;
+      link(e);
+    }
+  }
+  pending.clear();
+  if (!started) {
+    started = true;
+    lastTick = now;
+  }
+  unsigned long from = lastTick / resolution;
+  unsigned long to = now / resolution;
+  if (to - from >= slotCount) {
+    from = to - (slotCount - 1);
+  }
+  for (unsigned long t = from; t != to + 1; t++) {
+    collect(t % slotCount, now, due);
+  }
+  lastTick = now;
+  for (int e : relink) {
+    link(e);
+  }
+  relink.clear();
+}
+} // namespace homie
@@ -0,0 +1,168 @@
+#include "homie.hpp"
+namespace homie {
+
+/**
+ * Whether the len bytes at s follow the JSON number grammar, e.g. no "+1",
+ * ".5" or "inf"
+ */
+static bool isJsonNumber(const char *s, size_t len) {
+  const char *p = s;
+  const char *end = s + len;
+  if (p < end && *p == '-') {
+    p++;
+  }
+  if (p == end) {
+    return false;
+  }
+  if (*p == '0') {
+    p++;
+  } else if (*p >= '1' && *p <= '9') {
+    while (p < end && *p >= '0' && *p <= '9') {
+      p++;
+    }
+  } else {
+    return false;
+  }
+  if (p < end && *p == '.') {
+    p++;
+    if (p == end || *p < '0' || *p > '9') {
+      return false;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+      p++;
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < end && (*p == '+' || *p == '-')) {
+      p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+      return false;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+      p++;
+    }
+  }
+  return p == end;
+}
+
+SnapshotWriter::SnapshotWriter(std::string &buf, SnapshotEncoding e)
+    : out(buf), encoding(e), fields(0) {
+  out.clear();
+}
+
+void SnapshotWriter::cborHead(uint8_t major, uint64_t n) {
+  major <<= 5;
+  if (n < 24) {
+    out += (char)(major | n);
+    return;
+  }
+  int bytes = n <= 0xff ? 1 : n <= 0xffff ? 2 : n <= 0xffffffffu ? 4 : 8;
+  uint8_t info = bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27;
+  out += (char)(major | info);
+  for (int i = bytes - 1; i >= 0; i--) {
+    out += (char)((n >> (8 * i)) & 0xff);
+  }
+}
+
+void SnapshotWriter::cborText(const char *s, size_t len) {
+  cborHead(3, len);
+  out.append(s, len);
+}
+
+void SnapshotWriter::jsonText(const char *s, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  out += '"';
+  for (size_t i = 0; i < len; i++) {
+    char c = s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      out += "\\u00";
+      out += hex[(c >> 4) & 0xf];
+      out += hex[c & 0xf];
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+void SnapshotWriter::begin(size_t count) {
+  fields = 0;
+  if (encoding == SNAPSHOT_CBOR) {
+    cborHead(5, count);
+  } else {
+    out += '{';
+  }
+}
+
+void SnapshotWriter::field(const std::string &key, DataType type,
+                           const char *value, size_t len) {
+  bool isTrue = len == 4 && memcmp(value, "true", 4) == 0;
+  bool isBool = type == BOOLEAN &&
+                (isTrue || (len == 5 && memcmp(value, "false", 5) == 0));
+  bool isNumber = (type == INTEGER || type == FLOAT || type == PERCENT) &&
+                  isJsonNumber(value, len);
+  if (encoding == SNAPSHOT_JSON) {
+    if (fields++ > 0) {
+      out += ',';
+    }
+    jsonText(key.data(), key.size());
+    out += ':';
+    if (isBool || isNumber) {
+      out.append(value, len);
+    } else {
+      jsonText(value, len);
+    }
+    return;
+  }
+  fields++;
+  cborText(key.data(), key.size());
+  if (isBool) {
+    out += (char)(isTrue ? 0xf5 : 0xf4);
+    return;
+  }
+  if (isNumber) {
+    // strtoll and strtod need a terminated copy; numbers are short
+    char num[64];
+    std::string longer;
+    const char *s = num;
+    if (len < sizeof(num)) {
+      memcpy(num, value, len);
+      num[len] = 0;
+    } else {
+      longer.assign(value, len);
+      s = longer.c_str();
+    }
+    char *end;
+    errno = 0;
+    long long i = strtoll(s, &end, 10);
+    if (type == INTEGER && *end == 0 && errno == 0) {
+      if (i >= 0) {
+        cborHead(0, (uint64_t)i);
+      } else {
+        cborHead(1, (uint64_t)(-(i + 1)));
+      }
+      return;
+    }
+    double d = strtod(s, nullptr);
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    out += (char)0xfb;
+    for (int b = 7; b >= 0; b--) {
+      out += (char)((bits >> (8 * b)) & 0xff);
+    }
+    return;
+  }
+  cborText(value, len);
+}
+
+void SnapshotWriter::end() {
+  if (encoding == SNAPSHOT_JSON) {
+    out += '}';
+  }
+}
+} // namespace homie
@@ -0,0 +1,58 @@
+#include "homie.hpp"
+namespace homie {
+
+const int Log2Histogram::BUCKETS;
+
+void Log2Histogram::reset() {
+  memset(buckets, 0, sizeof(buckets));
+  count = 0;
+  sum = 0;
+  max = 0;
+}
+
+void Log2Histogram::record(uint32_t v) {
+  int i = 0;
+  for (uint32_t x = v; x != 0; x >>= 1) {
+    i++;
+  }
+  buckets[i]++;
+  count++;
+  sum += v;
+  if (v > max) {
+    max = v;
+  }
+}
+
+uint32_t Log2Histogram::percentile(double p) {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)std::ceil(p / 100 * count);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      uint64_t upper = i == 0 ? 0 : (((uint64_t)1 << i) - 1);
+      return upper < max ? (uint32_t)upper : max;
+    }
+  }
+  return max;
+}
+
+void DeviceStats::recordRead(uint32_t micros) {
+#ifdef HOMIE_THREADS
+  std::lock_guard<std::mutex> guard(readLock);
+#endif
+  readMicros.record(micros);
+}
+
+uint32_t DeviceStats::readPercentile(double p) {
+#ifdef HOMIE_THREADS
+  std::lock_guard<std::mutex> guard(readLock);
+#endif
+  return readMicros.percentile(p);
+}
+} // namespace homie
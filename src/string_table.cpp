@@ -0,0 +1,54 @@
+#include "homie.hpp"
+namespace homie {
+StringTable &StringTable::shared() {
+  static StringTable table;
+  return table;
+}
+
+const std::string *StringTable::intern(const std::string &s) {
+#ifdef HOMIE_THREADS
+  std::lock_guard<std::mutex> guard(lock);
+#endif
+  // elements of an unordered_map never move, even on rehash
+  auto e = strings.insert(std::make_pair(s, (size_t)0)).first;
+  e->second++;
+  return &e->first;
+}
+
+void StringTable::retain(const std::string *s) {
+#ifdef HOMIE_THREADS
+  std::lock_guard<std::mutex> guard(lock);
+#endif
+  strings.find(*s)->second++;
+}
+
+void StringTable::release(const std::string *s) {
+#ifdef HOMIE_THREADS
+  std::lock_guard<std::mutex> guard(lock);
+#endif
+  auto e = strings.find(*s);
+  if (--e->second == 0) {
+    strings.erase(e);
+  }
+}
+
+size_t StringTable::size() {
+#ifdef HOMIE_THREADS
+  std::lock_guard<std::mutex> guard(lock);
+#endif
+  return strings.size();
+}
+
+MemoryUsage StringTable::memoryUsage() {
+#ifdef HOMIE_THREADS
+  std::lock_guard<std::mutex> guard(lock);
+#endif
+  MemoryUsage u;
+  for (auto &e : strings) {
+    u.containers += hashNodeBytes(sizeof(e));
+    u.strings += heapBytes(e.first);
+  }
+  u.containers += strings.bucket_count() * sizeof(void *);
+  return u;
+}
+} // namespace homie
@@ -0,0 +1,182 @@
+#include "homie.hpp"
+namespace homie {
+
+bool SubscriptionTrie::isValidFilter(const std::string &filter) {
+  if (filter.empty()) {
+    return false;
+  }
+  size_t start = 0;
+  for (;;) {
+    size_t slash = filter.find('/', start);
+    size_t end = slash == std::string::npos ? filter.length() : slash;
+    for (size_t i = start; i < end; i++) {
+      char c = filter[i];
+      // wildcards must fill a whole level, and # must be the last one
+      if ((c == '+' || c == '#') && end - start != 1) {
+        return false;
+      }
+      if (c == '#' && slash != std::string::npos) {
+        return false;
+      }
+    }
+    if (slash == std::string::npos) {
+      return true;
+    }
+    start = slash + 1;
+  }
+}
+
+bool SubscriptionTrie::add(const std::string &filter, MessageHandler h) {
+  if (!isValidFilter(filter)) {
+    return false;
+  }
+  Level *level = &root;
+  size_t start = 0;
+  for (;;) {
+    size_t slash = filter.find('/', start);
+    size_t end = slash == std::string::npos ? filter.length() : slash;
+    if (filter.compare(start, end - start, "#") == 0) {
+      level->multi.push_back(h);
+      break;
+    }
+    std::unique_ptr<Level> *next;
+    if (filter.compare(start, end - start, "+") == 0) {
+      next = &level->plus;
+    } else {
+      next = &level->children[filter.substr(start, end - start)];
+    }
+    if (!*next) {
+      next->reset(new Level());
+    }
+    level = next->get();
+    if (slash == std::string::npos) {
+      level->exact.push_back(h);
+      break;
+    }
+    start = slash + 1;
+  }
+  filters[filter]++;
+  return true;
+}
+
+bool SubscriptionTrie::remove(const std::string &filter) {
+  auto search = filters.find(filter);
+  if (search == filters.end()) {
+    return false;
+  }
+  filters.erase(search);
+  Level *level = &root;
+  size_t start = 0;
+  for (;;) {
+    size_t slash = filter.find('/', start);
+    size_t end = slash == std::string::npos ? filter.length() : slash;
+    if (filter.compare(start, end - start, "#") == 0) {
+      level->multi.clear();
+      return true;
+    }
+    if (filter.compare(start, end - start, "+") == 0) {
+      level = level->plus.get();
+    } else {
+      level = level->children[filter.substr(start, end - start)].get();
+    }
+    if (slash == std::string::npos) {
+      level->exact.clear();
+      return true;
+    }
+    start = slash + 1;
+  }
+}
+
+size_t SubscriptionTrie::match(Level *level, const std::string &topic,
+                               size_t pos, const Message &m) {
+  // a wildcard at the first level doesn't match $SYS-style topics
+  bool wild = pos > 0 || topic.empty() || topic[0] != '$';
+  size_t n = 0;
+  if (wild) {
+    for (auto &h : level->multi) {
+      h(m);
+      n++;
+    }
+  }
+  size_t slash = topic.find('/', pos);
+  size_t end = slash == std::string::npos ? topic.length() : slash;
+  Level *next[2] = {nullptr, wild ? level->plus.get() : nullptr};
+  if (!level->children.empty()) {
+    key.assign(topic, pos, end - pos);
+    auto search = level->children.find(key);
+    if (search != level->children.end()) {
+      next[0] = search->second.get();
+    }
+  }
+  for (Level *l : next) {
+    if (!l) {
+      continue;
+    }
+    if (slash == std::string::npos) {
+      for (auto &h : l->exact) {
+        h(m);
+        n++;
+      }
+      for (auto &h : l->multi) {
+        h(m);
+        n++;
+      }
+    } else {
+      n += match(l, topic, slash + 1, m);
+    }
+  }
+  return n;
+}
+
+size_t SubscriptionTrie::dispatch(const Message &m) {
+  return match(&root, m.topic, 0, m);
+}
+
+bool SubscriptionTrie::covers(const std::string &general,
+                              const std::string &specific) {
+  size_t g = 0, s = 0;
+  for (;;) {
+    size_t gSlash = general.find('/', g);
+    size_t gEnd = gSlash == std::string::npos ? general.length() : gSlash;
+    if (general.compare(g, gEnd - g, "#") == 0) {
+      return g > 0 || specific.empty() || specific[0] != '$';
+    }
+    size_t sSlash = specific.find('/', s);
+    size_t sEnd = sSlash == std::string::npos ? specific.length() : sSlash;
+    bool sHash = specific.compare(s, sEnd - s, "#") == 0;
+    if (general.compare(g, gEnd - g, "+") == 0) {
+      if (sHash || (s == 0 && specific[0] == '$')) {
+        return false;
+      }
+    } else if (general.compare(g, gEnd - g, specific, s, sEnd - s) != 0) {
+      return false;
+    }
+    if (gSlash == std::string::npos) {
+      return sSlash == std::string::npos;
+    }
+    if (sSlash == std::string::npos) {
+      // "a/#" also matches "a"
+      return general.compare(gSlash + 1, std::string::npos, "#") == 0;
+    }
+    g = gSlash + 1;
+    s = sSlash + 1;
+  }
+}
+
+std::vector<std::string> SubscriptionTrie::minimalFilters() {
+  std::vector<std::string> result;
+  for (auto &a : filters) {
+    bool covered = false;
+    for (auto &b : filters) {
+      if (&a != &b && covers(b.first, a.first)) {
+        covered = true;
+        break;
+      }
+    }
+    if (!covered) {
+      result.push_back(a.first);
+    }
+  }
+  return result;
+}
+} // namespace homie
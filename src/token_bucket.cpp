@@ -0,0 +1,59 @@
+#include "homie.hpp"
+namespace homie {
+TokenBucket::TokenBucket(unsigned long ratePerSec, unsigned long aburst) {
+  configure(ratePerSec, aburst);
+}
+
+void TokenBucket::configure(unsigned long ratePerSec, unsigned long aburst) {
+  rate = ratePerSec;
+  burst = aburst > 0 ? aburst : (rate > 0 ? rate : 1);
+  level = (long long)burst * 1000;
+  lastRefill = 0;
+  started = false;
+}
+
+void TokenBucket::refill(unsigned long now) {
+  if (!started) {
+    started = true;
+    lastRefill = now;
+    return;
+  }
+  // unsigned subtraction copes with clock wrap-around
+  unsigned long elapsed = now - lastRefill;
+  lastRefill = now;
+  level += (long long)elapsed * rate;
+  if (level > (long long)burst * 1000) {
+    level = (long long)burst * 1000;
+  }
+}
+
+bool TokenBucket::canTake(unsigned long n) {
+  if (!isLimited()) {
+    return true;
+  }
+  return level >= (long long)n * 1000 || level >= (long long)burst * 1000;
+}
+
+void TokenBucket::take(unsigned long n) {
+  if (isLimited()) {
+    level -= (long long)n * 1000;
+  }
+}
+
+unsigned long TokenBucket::waitFor(unsigned long n) {
+  if (canTake(n)) {
+    return 0;
+  }
+  long long target = (long long)(n < burst ? n : burst) * 1000;
+  return (unsigned long)((target - level + rate - 1) / rate);
+}
+
+bool TokenBucket::tryTake(unsigned long n, unsigned long now) {
+  refill(now);
+  if (!canTake(n)) {
+    return false;
+  }
+  take(n);
+  return true;
+}
+} // namespace homie
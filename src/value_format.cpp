@@ -0,0 +1,129 @@
+#include "homie.hpp"
+namespace homie {
+/** Strict base-10 integer: optional '-', then 1 to 18 digits */
+static bool parseInteger(const char *s, size_t len, int64_t &out) {
+  size_t i = len > 0 && s[0] == '-' ? 1 : 0;
+  if (i == len || len - i > 18) {
+    return false;
+  }
+  int64_t v = 0;
+  for (; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9') {
+      return false;
+    }
+    v = v * 10 + (s[i] - '0');
+  }
+  out = s[0] == '-' ? -v : v;
+  return true;
+}
+
+/** A finite number taking up all of s, which must be NUL-terminated */
+static bool parseNumber(const char *s, size_t len, double &out) {
+  if (len == 0 || isspace((unsigned char)s[0])) {
+    return false;
+  }
+  char *end;
+  double v = strtod(s, &end);
+  if (end != s + len || !std::isfinite(v)) {
+    return false;
+  }
+  out = v;
+  return true;
+}
+
+ValueFormat::ValueFormat(DataType atype, const std::string *format)
+    : type(atype), hasMin(false), hasMax(false), intMin(0), intMax(0),
+      floatMin(0), floatMax(0), hsv(false), list(format) {
+  static const std::string none;
+  const std::string &f = format ? *format : none;
+  switch (type) {
+  case INTEGER:
+  case FLOAT:
+  case PERCENT: {
+    size_t colon = f.find(':');
+    if (colon == std::string::npos) {
+      break;
+    }
+    std::string from = f.substr(0, colon);
+    std::string to = f.substr(colon + 1);
+    if (type == INTEGER) {
+      hasMin = parseInteger(from.c_str(), from.size(), intMin);
+      hasMax = parseInteger(to.c_str(), to.size(), intMax);
+    } else {
+      hasMin = parseNumber(from.c_str(), from.size(), floatMin);
+      hasMax = parseNumber(to.c_str(), to.size(), floatMax);
+    }
+    break;
+  }
+  case ENUM: {
+    size_t start = 0;
+    while (!f.empty() && entries.size() < 256) {
+      size_t end = f.find(',', start);
+      size_t n = (end == std::string::npos ? f.length() : end) - start;
+      entries.push_back(std::make_pair((uint16_t)start, (uint16_t)n));
+      if (end == std::string::npos) {
+        break;
+      }
+      start = end + 1;
+    }
+    break;
+  }
+  case COLOR:
+    hsv = f == "hsv";
+    break;
+  default:
+    break;
+  }
+}
+
+bool ValueFormat::parse(const std::string &payload, CommandValue &out) const {
+  const char *s = payload.c_str();
+  size_t len = payload.size();
+  out.type = type;
+  switch (type) {
+  case INTEGER:
+    return parseInteger(s, len, out.integer) &&
+           !(hasMin && out.integer < intMin) &&
+           !(hasMax && out.integer > intMax);
+  case FLOAT:
+  case PERCENT:
+    return parseNumber(s, len, out.number) &&
+           !(hasMin && out.number < floatMin) &&
+           !(hasMax && out.number > floatMax);
+  case BOOLEAN:
+    out.boolean = payload == "true";
+    return out.boolean || payload == "false";
+  case ENUM:
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (entries[i].second == len &&
+          memcmp(list->data() + entries[i].first, s, len) == 0) {
+        out.index = (uint8_t)i;
+        return true;
+      }
+    }
+    return false;
+  case COLOR: {
+    static const uint16_t rgbMax[] = {255, 255, 255};
+    static const uint16_t hsvMax[] = {360, 100, 100};
+    const uint16_t *max = hsv ? hsvMax : rgbMax;
+    size_t start = 0;
+    for (int i = 0; i < 3; i++) {
+      size_t end = payload.find(',', start);
+      if ((end == std::string::npos) != (i == 2)) {
+        return false;
+      }
+      size_t n = (i == 2 ? len : end) - start;
+      int64_t v;
+      if (n > 3 || !parseInteger(s + start, n, v) || v < 0 || v > max[i]) {
+        return false;
+      }
+      out.color[i] = (uint16_t)v;
+      start = end + 1;
+    }
+    return true;
+  }
+  default:
+    return true;
+  }
+}
+} // namespace homie
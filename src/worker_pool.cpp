@@ -0,0 +1,46 @@
+#include "homie.hpp"
+#ifdef HOMIE_THREADS
+namespace homie {
+WorkerPool::WorkerPool(size_t threads) {
+  stopping = false;
+  for (size_t i = 0; i < (threads > 0 ? threads : 1); i++) {
+    workers.push_back(std::thread([this]() { this->run(); }));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    tasks.push_back(task);
+  }
+  wake.notify_one();
+}
+
+void WorkerPool::run() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [this]() { return stopping || !tasks.empty(); });
+      if (tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+} // namespace homie
+#endif
@@ -5,7 +5,7 @@ const bool dtor_debug = false;
 
 homie::Device::~Device() {
   for (auto node : this->nodes) {
-    delete node.second;
+    this->destroy(node.second);
   }
 }
 
@@ -13,11 +13,11 @@ homie::Node::~Node() {
   if (dtor_debug)
     std::cerr << " . Deleting node " << this->id << std::endl;
   for (auto prop : this->properties) {
-    delete prop.second;
+    this->device->destroy(prop.second);
   }
 }
 
 homie::Property::~Property() {
   if (dtor_debug)
-    std::cerr << " .   Deleting prop " << this->id << std::endl;
+    std::cerr << " .   Deleting prop " << *this->id << std::endl;
 }
\ No newline at end of file
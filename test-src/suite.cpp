@@ -3,11 +3,16 @@
 #include <gtest/gtest.h>
 #include <list>
 #include <string>
+#ifdef HOMIE_THREADS
+#include <atomic>
+#include <thread>
+#endif
 
 using Msg = homie::Message;
 class TestDevice : public homie::Device {
 public:
-  TestDevice() : homie::Device("testdevice", "1.0", "TestDevice") {
+  TestDevice(size_t arenaBytes = 0)
+      : homie::Device("testdevice", "1.0", "TestDevice", "homie", arenaBytes) {
     extensions.push_back("com.planetlauritsen.test:0.0.1:[4.x]");
   }
   std::list<homie::Message> publications;
@@ -252,7 +257,7 @@ TEST_F(PropertyTest, CheckLwtIsLost) { EXPECT_EQ("lost", d->getLwt().payload); }
 TEST_F(WritablePropertyTest, CheckInputMessage) {
   auto inputMsg =
       Msg("homie/" + d->getId() + "/" + n->getId() + "/" + p->getId() + "/set",
-          "awesome new value");
+          "42");
   d->onMessage(inputMsg);
   EXPECT_EQ(inputMsg.payload, p->getValue());
 }
@@ -268,4 +273,1618 @@ TEST_F(PropertyTest, InputMessageIgnoredForNonWritableProperty) {
 
 TEST_F(PropertyTest, CheckExtensions) {
   EXPECT_EQ(2, d->getExtensions().size());
-}
\ No newline at end of file
+}
+TEST_F(WritablePropertyTest, RouteResolvesSubTopic) {
+  EXPECT_EQ(p, d->findRoute(p->getSubTopic()));
+  EXPECT_EQ(nullptr, d->findRoute(p->getPubTopic()))
+      << "Only command topics should be routed";
+}
+
+TEST_F(WritablePropertyTest, InputMessageForUnknownTopicIgnored) {
+  p->setValue("previous");
+  d->onMessage(Msg("homie/" + d->getId() + "/nosuchnode/prop1/set", "x"));
+  d->onMessage(Msg("homie/" + d->getId() + "/node1/nosuchprop/set", "x"));
+  d->onMessage(Msg("homie/" + d->getId() + "/node1/prop1", "x"));
+  EXPECT_EQ("previous", p->getValue());
+}
+
+TEST(HomieSuite, TokenBucketRefills) {
+  homie::TokenBucket b(10, 2); // 10/s, burst of 2
+  EXPECT_TRUE(b.tryTake(1, 0));
+  EXPECT_TRUE(b.tryTake(1, 0));
+  EXPECT_FALSE(b.tryTake(1, 0)) << "Burst should be exhausted";
+  EXPECT_FALSE(b.tryTake(1, 50));
+  EXPECT_TRUE(b.tryTake(1, 100)) << "One token should refill per 100ms";
+  EXPECT_TRUE(homie::TokenBucket(0).tryTake(1000000, 0))
+      << "A zero rate is unlimited";
+}
+
+TEST(HomieSuite, OutboxDropsWhenFull) {
+  homie::Outbox box(2);
+  EXPECT_TRUE(box.push(Msg("a", "1")));
+  EXPECT_TRUE(box.push(Msg("b", "2")));
+  EXPECT_FALSE(box.push(Msg("c", "3")));
+  EXPECT_EQ(2, box.depth());
+  EXPECT_EQ(1, box.getDropped());
+  Msg m;
+  EXPECT_TRUE(box.pop(0, m));
+  EXPECT_EQ("a", m.topic);
+  EXPECT_TRUE(box.pop(0, m));
+  EXPECT_EQ("b", m.topic);
+  EXPECT_FALSE(box.pop(0, m));
+  EXPECT_EQ(2, box.getSent());
+  EXPECT_EQ(2, box.getHighWater());
+}
+
+TEST_F(PropertyTest, OutboxPacesIntroduction) {
+  d->enableOutbox(128, 10); // 10 messages per second
+  d->introduce();
+  EXPECT_EQ(0, d->publications.size()) << "Nothing is sent before pump()";
+  auto queued = d->getOutbox()->depth();
+  EXPECT_GT(queued, 10);
+  EXPECT_EQ(10, d->pump(0)) << "The initial burst is one second's worth";
+  EXPECT_EQ(0, d->pump(50));
+  EXPECT_EQ(1, d->pump(150));
+  unsigned long now = 150;
+  while (d->getOutbox()->depth() > 0) {
+    now += 1000;
+    EXPECT_LE(d->pump(now), 10) << "Never more than the burst at once";
+  }
+  EXPECT_EQ(queued, d->publications.size());
+  EXPECT_EQ("homie/testdevice/$homie", d->publications.front().topic);
+  EXPECT_EQ("ready", d->publications.back().payload);
+}
+
+TEST_F(PropertyTest, OutboxByteBudget) {
+  d->enableOutbox(8, 0, 30); // 30 bytes per second
+  p->publish();              // "homie/testdevice/node1/prop1" + "s1" = 30
+  p->publish();
+  EXPECT_EQ(1, d->pump(0));
+  EXPECT_EQ(0, d->pump(500));
+  EXPECT_EQ(1, d->pump(1000));
+}
+
+TEST(HomieSuite, OutboxCoalescesByKey) {
+  homie::Outbox box(4, 0, 0, true);
+  int a, b;
+  EXPECT_TRUE(box.push(Msg("meta", "1")));
+  EXPECT_TRUE(box.push(Msg("a", "1"), &a));
+  EXPECT_TRUE(box.push(Msg("meta", "2")));
+  EXPECT_TRUE(box.push(Msg("a", "2"), &a));
+  EXPECT_TRUE(box.push(Msg("b", "1"), &b));
+  EXPECT_EQ(4, box.depth()) << "a/2 replaced a/1 in place";
+  EXPECT_EQ(1, box.getCoalesced());
+  EXPECT_FALSE(box.push(Msg("meta", "3"))) << "Unkeyed messages still queue";
+
+  Msg m;
+  std::vector<std::string> order;
+  while (box.pop(0, m)) {
+    order.push_back(m.topic + "=" + m.payload);
+  }
+  EXPECT_EQ(std::vector<std::string>({"meta=1", "a=2", "meta=2", "b=1"}),
+            order);
+  EXPECT_TRUE(box.push(Msg("a", "3"), &a)) << "Sent keys are forgotten";
+  EXPECT_EQ(1, box.depth());
+  EXPECT_EQ(1, box.getCoalesced());
+}
+
+TEST_F(PropertyTest, CoalescingOutboxBoundsChattyProperty) {
+  d->enableOutbox(64, 5, 0, true);
+  int counter = 0;
+  auto chatty = new homie::Property(n, "chatty", "Chatty", homie::INTEGER,
+                                    false, [&counter]() {
+                                      return std::to_string(counter++);
+                                    });
+  d->introduce();
+  size_t introduced = d->getOutbox()->depth();
+  for (int i = 0; i < 1000; i++) {
+    chatty->publish();
+    p->publish();
+  }
+  EXPECT_EQ(introduced + 2, d->getOutbox()->depth());
+  EXPECT_EQ(0, d->getOutbox()->getDropped());
+  unsigned long now = 0;
+  while (d->getOutbox()->depth() > 0) {
+    d->pump(now += 1000);
+  }
+  std::vector<Msg> sent(d->publications.begin(), d->publications.end());
+  ASSERT_EQ(introduced + 2, sent.size());
+  EXPECT_EQ("homie/testdevice/$homie", sent.front().topic);
+  EXPECT_EQ("ready", sent[introduced - 1].payload) << "Order is kept";
+  EXPECT_EQ(chatty->getPubTopic(), sent[introduced].topic);
+  EXPECT_EQ(std::to_string(counter - 1), sent[introduced].payload)
+      << "Only the newest value is sent";
+}
+
+TEST_F(PropertyTest, IntroductionMatchesIntroduce) {
+  p->setUnit("jigawatts");
+  new homie::Property(n, "prop2", "Prop2", homie::FLOAT, false,
+                      []() { return "2.5"; });
+  d->introduce();
+  auto eager = d->publications;
+
+  homie::Introduction intro(d);
+  std::list<Msg> pulled;
+  Msg m;
+  while (pulled.size() < 7 && intro.next(m)) {
+    pulled.push_back(m);
+  }
+  // pause part way and send other traffic; the cursor resumes where it
+  // left off
+  ASSERT_EQ(7, pulled.size());
+  EXPECT_FALSE(intro.isDone());
+  size_t before = d->publications.size();
+  d->send(Msg("homie/testdevice/unrelated", "x"));
+  p->publish();
+  EXPECT_EQ(before + 2, d->publications.size());
+  while (intro.next(m)) {
+    pulled.push_back(m);
+  }
+  EXPECT_TRUE(intro.isDone());
+  EXPECT_FALSE(intro.next(m));
+  ASSERT_EQ(eager.size(), pulled.size());
+  auto e = eager.begin();
+  for (auto &x : pulled) {
+    EXPECT_EQ(e->topic, x.topic);
+    EXPECT_EQ(e->payload, x.payload);
+    ++e;
+  }
+  EXPECT_EQ(homie::READY, d->getLifecycleState());
+}
+
+TEST_F(PropertyTest, IntroductionSkipsEmptyAttributes) {
+  unsigned step = 0;
+  Msg m;
+  std::list<Msg> l;
+  while (p->nextIntroduction(step, m)) {
+    l.push_back(m);
+  }
+  EXPECT_EQ(4, l.size()) << "$name, $settable, $datatype and the value";
+  EXPECT_EQ(p->getPubTopic(), l.back().topic);
+}
+
+TEST_F(PropertyTest, FingerprintSkipsRedundantIntroduction) {
+  auto fp = d->getFingerprint();
+  EXPECT_EQ(16, fp.length());
+  EXPECT_EQ(fp, d->getFingerprint()) << "Fingerprint should be stable";
+  EXPECT_FALSE(d->isTopologyPublished());
+
+  d->introduce();
+  auto full = d->publications.size();
+  auto fpMsg = std::find_if(
+      d->publications.begin(), d->publications.end(),
+      [this](Msg m) { return m.topic == d->getFingerprintTopic(); });
+  ASSERT_NE(d->publications.end(), fpMsg);
+  EXPECT_EQ(fp, fpMsg->payload);
+
+  // reconnect: the broker hands back the retained fingerprint
+  d->onMessage(*fpMsg);
+  EXPECT_TRUE(d->isTopologyPublished());
+  d->publications.clear();
+  d->introduce();
+  EXPECT_LT(d->publications.size(), full);
+  EXPECT_EQ(0, std::count_if(d->publications.begin(), d->publications.end(),
+                             [](Msg m) {
+                               return m.topic.find("/$") != std::string::npos &&
+                                      m.topic.find("/$state") ==
+                                          std::string::npos;
+                             }))
+      << "Only values and $state should be sent";
+  EXPECT_EQ(1, std::count_if(
+                   d->publications.begin(), d->publications.end(),
+                   [this](Msg m) { return m.topic == p->getPubTopic(); }));
+  EXPECT_EQ("ready", d->publications.back().payload);
+}
+
+TEST_F(PropertyTest, FingerprintChangesWithTopology) {
+  auto fp = d->getFingerprint();
+  d->onMessage(Msg(d->getFingerprintTopic(), fp));
+  p->setUnit("jigawatts");
+  EXPECT_NE(fp, d->getFingerprint());
+  EXPECT_FALSE(d->isTopologyPublished());
+  d->introduce();
+  EXPECT_EQ(1, std::count_if(d->publications.begin(), d->publications.end(),
+                             [](Msg m) {
+                               return m.topic.find("$unit") !=
+                                      std::string::npos;
+                             }));
+}
+
+TEST_F(PropertyTest, PublishIfChangedSkipsUnchanged) {
+  std::string reading = "s1";
+  p->readerFunc = [&reading]() { return reading; };
+  EXPECT_TRUE(p->publishIfChanged(0)) << "First publication always goes out";
+  EXPECT_FALSE(p->publishIfChanged(10));
+  reading = "s2";
+  EXPECT_TRUE(p->publishIfChanged(20));
+  EXPECT_EQ("s2", p->getValue());
+  EXPECT_EQ(2, d->publications.size());
+}
+
+TEST_F(PropertyTest, PublishIfChangedDeadbandAndHeartbeat) {
+  std::string reading = "20.0";
+  p->readerFunc = [&reading]() { return reading; };
+  p->setPublishPolicy(homie::PublishPolicy(0.5, 0, 1000));
+  EXPECT_TRUE(p->publishIfChanged(0));
+  reading = "20.4";
+  EXPECT_FALSE(p->publishIfChanged(100)) << "Within absolute deadband";
+  reading = "20";
+  EXPECT_FALSE(p->publishIfChanged(200)) << "Numerically equal";
+  reading = "20.6";
+  EXPECT_TRUE(p->publishIfChanged(300));
+  EXPECT_FALSE(p->publishIfChanged(800));
+  EXPECT_TRUE(p->publishIfChanged(1300)) << "Heartbeat forces a publication";
+  d->tick(2000);
+  p->publish();
+  EXPECT_FALSE(p->publishIfChanged(2500))
+      << "The heartbeat counts from the manual publish";
+  EXPECT_TRUE(p->publishIfChanged(3000));
+
+  p->setPublishPolicy(homie::PublishPolicy(0, 0.1));
+  reading = "22";
+  EXPECT_FALSE(p->publishIfChanged(1400)) << "Within 10% of 20.6";
+  reading = "23";
+  EXPECT_TRUE(p->publishIfChanged(1500));
+}
+
+TEST_F(WritablePropertyTest, CommandForcesRepublish) {
+  EXPECT_TRUE(p->publishIfChanged(0));
+  p->setValue("s1");
+  EXPECT_TRUE(p->publishIfChanged(1))
+      << "A value set by command should be acknowledged";
+}
+
+TEST_F(PropertyTest, PublishWifiOnlyOnChange) {
+  d->publishWifi(0);
+  EXPECT_EQ(2, d->publications.size());
+  d->rssi = -59;
+  d->publishWifi(1000);
+  EXPECT_EQ(2, d->publications.size()) << "Flat RSSI should not be resent";
+  d->rssi = -70;
+  d->publishWifi(2000);
+  EXPECT_EQ(4, d->publications.size());
+  d->publishWifi(400000);
+  EXPECT_EQ(6, d->publications.size()) << "Heartbeat";
+}
+
+TEST_F(PropertyTest, SchedulerSamplesAtInterval) {
+  int reads = 0;
+  p->readerFunc = [&reads]() { return std::to_string(++reads); };
+  p->setSampleInterval(1000);
+  unsigned long first = 0;
+  for (unsigned long t = 0; t < 1000 && first == 0; t += 10) {
+    if (d->tick(t) > 0)
+      first = t;
+  }
+  EXPECT_EQ(1, reads) << "First sample falls somewhere in the first interval";
+  EXPECT_EQ(0, d->tick(first + 500));
+  EXPECT_EQ(1, d->tick(first + 1000));
+  EXPECT_EQ(0, d->tick(first + 1050));
+  EXPECT_EQ(1, d->tick(first + 10000)) << "Missed samples are not replayed";
+  EXPECT_EQ(3, reads);
+  EXPECT_EQ(0, d->tick(first + 10500));
+  EXPECT_EQ(1, d->tick(first + 11000)) << "Phase is kept after a gap";
+
+  p->setSampleInterval(0);
+  EXPECT_EQ(0, d->tick(first + 12000));
+  EXPECT_EQ(0, d->tick(first + 13000));
+}
+
+TEST_F(PropertyTest, SchedulerSpreadsSamples) {
+  for (int i = 0; i < 200; i++) {
+    auto prop = new homie::Property(n, "p" + std::to_string(i), "P",
+                                    homie::INTEGER, false,
+                                    []() { return "1"; });
+    prop->setSampleInterval(10000);
+  }
+  size_t maxBatch = 0, total = 0;
+  for (unsigned long t = 0; t < 10000; t += 100) {
+    size_t batch = d->tick(t);
+    maxBatch = std::max(maxBatch, batch);
+    total += batch;
+  }
+  total += d->tick(9999);
+  EXPECT_EQ(200, total) << "Every property sampled once per interval";
+  EXPECT_LT(maxBatch, 20) << "Samples should be spread over the interval";
+}
+
+TEST(HomieSuite, formatNumbers) {
+  char buf[16];
+  EXPECT_EQ(3, homie::formatInt(-42, buf, sizeof(buf)));
+  EXPECT_STREQ("-42", buf);
+  homie::formatInt(INT32_MIN, buf, sizeof(buf));
+  EXPECT_STREQ("-2147483648", buf);
+  EXPECT_EQ(0, homie::formatInt(12345, buf, 3)) << "Too small a buffer";
+  homie::formatFloat(21.456f, 2, buf, sizeof(buf));
+  EXPECT_STREQ("21.46", buf);
+  homie::formatFloat(-0.5f, 0, buf, sizeof(buf));
+  EXPECT_STREQ("-1", buf);
+  homie::formatFloat(3.0f, 3, buf, sizeof(buf));
+  EXPECT_STREQ("3.000", buf);
+  homie::formatFloat(0.05f, 1, buf, sizeof(buf));
+  EXPECT_STREQ("0.1", buf);
+  EXPECT_EQ("100000002004087734272.0", homie::f2s(1e20f))
+      << "Large floats must not overflow the buffer";
+  EXPECT_EQ("nan", homie::f2s(NAN));
+  EXPECT_EQ("-58", homie::to_string(-58));
+}
+
+TEST(HomieSuite, formatEnum) {
+  char buf[16];
+  homie::formatEnum(1, "low,medium,high", buf, sizeof(buf));
+  EXPECT_STREQ("medium", buf);
+  homie::formatEnum(2, "low,medium,high", buf, sizeof(buf));
+  EXPECT_STREQ("high", buf);
+  EXPECT_EQ(0, homie::formatEnum(3, "low,medium,high", buf, sizeof(buf)));
+  EXPECT_EQ(2, homie::enumIndexOf("high", "low,medium,high"));
+  EXPECT_EQ(-1, homie::enumIndexOf("hi", "low,medium,high"));
+}
+
+TEST_F(PropertyTest, TypedPropertyPublishesNativeValue) {
+  float temperature = 21.5f;
+  auto t = new homie::TypedProperty<float>(
+      n, "temp", "Temperature", false,
+      [&temperature]() { return temperature; });
+  EXPECT_EQ("float", t->getDataTypeString());
+  t->publish();
+  EXPECT_EQ("21.50", d->publications.back().payload);
+  temperature = -3.25f;
+  t->setDecimals(1);
+  t->publish();
+  EXPECT_EQ("-3.3", d->publications.back().payload);
+
+  auto b = new homie::TypedProperty<bool>(n, "on", "On");
+  EXPECT_EQ("boolean", b->getDataTypeString());
+  b->set(true);
+  b->publish();
+  EXPECT_EQ("true", d->publications.back().payload);
+
+  // the largest values still fit, rather than publishing nothing
+  temperature = -std::numeric_limits<float>::max();
+  t->setDecimals(9);
+  t->publish();
+  EXPECT_EQ(50, d->publications.back().payload.length());
+  auto mode = new homie::TypedProperty<homie::EnumIndex>(n, "mode", "Mode");
+  std::string longest(100, 'x');
+  mode->setFormat("off," + longest);
+  mode->set(homie::EnumIndex(1));
+  mode->publish();
+  EXPECT_EQ(longest, d->publications.back().payload);
+}
+
+TEST_F(PropertyTest, TypedPropertyParsesCommands) {
+  auto mode =
+      new homie::TypedProperty<homie::EnumIndex>(n, "mode", "Mode", true);
+  mode->setFormat("off,heat,cool");
+  std::list<int> writes;
+  mode->setNativeWriter(
+      [&writes](homie::EnumIndex v) { writes.push_back(v.index); });
+  d->onMessage(Msg(mode->getSubTopic(), "cool"));
+  d->onMessage(Msg(mode->getSubTopic(), "warp"));
+  ASSERT_EQ(1, writes.size()) << "Unknown enum values are not written";
+  EXPECT_EQ(2, writes.front());
+  EXPECT_EQ(2, mode->get().index);
+  mode->publish();
+  EXPECT_EQ("cool", d->publications.back().payload);
+
+  auto level = new homie::TypedProperty<int32_t>(n, "level", "Level", true);
+  level->setNativeWriter([](int32_t) {});
+  d->onMessage(Msg(level->getSubTopic(), "42"));
+  d->onMessage(Msg(level->getSubTopic(), "42abc"));
+  EXPECT_EQ(42, level->get());
+
+  // a plain writer, or none, must not leave the native value behind
+  auto dimmer = new homie::TypedProperty<float>(n, "dim", "Dim", true);
+  std::string raw;
+  dimmer->setWriterFunc([&raw](std::string v) { raw = v; });
+  d->onMessage(Msg(dimmer->getSubTopic(), "0.5"));
+  EXPECT_EQ("0.5", raw);
+  EXPECT_EQ(0.5f, dimmer->get());
+  dimmer->publish();
+  EXPECT_EQ("0.50", d->publications.back().payload);
+  auto unwired = new homie::TypedProperty<bool>(n, "flag", "Flag", true);
+  d->onMessage(Msg(unwired->getSubTopic(), "true"));
+  EXPECT_TRUE(unwired->get());
+}
+
+TEST(HomieSuite, ValueFormatValidates) {
+  homie::CommandValue v;
+  std::string range("10:15");
+  homie::ValueFormat level(homie::INTEGER, &range);
+  EXPECT_TRUE(level.parse("12", v));
+  EXPECT_EQ(12, v.integer);
+  for (auto bad : {"9", "16", "12.0", "12abc", "", "-"}) {
+    EXPECT_FALSE(level.parse(bad, v)) << bad;
+  }
+  std::string floor(":-0.5");
+  homie::ValueFormat temp(homie::FLOAT, &floor);
+  EXPECT_TRUE(temp.parse("-2e1", v));
+  EXPECT_DOUBLE_EQ(-20, v.number);
+  EXPECT_FALSE(temp.parse("0", v));
+  EXPECT_FALSE(temp.parse("nan", v));
+  std::string modes("off,heat,cool");
+  homie::ValueFormat mode(homie::ENUM, &modes);
+  EXPECT_TRUE(mode.parse("cool", v));
+  EXPECT_EQ(2, v.index);
+  EXPECT_FALSE(mode.parse("coo", v));
+  EXPECT_FALSE(mode.parse("off,heat", v));
+  std::string hsv("hsv");
+  homie::ValueFormat color(homie::COLOR, &hsv);
+  EXPECT_TRUE(color.parse("360,100,0", v));
+  EXPECT_EQ(360, v.color[0]);
+  EXPECT_FALSE(color.parse("60,101,0", v));
+  EXPECT_FALSE(color.parse("60,100", v));
+  homie::ValueFormat rgb(homie::COLOR);
+  EXPECT_TRUE(rgb.parse("255,255,0", v));
+  EXPECT_FALSE(rgb.parse("255,256,0", v));
+  homie::ValueFormat flag(homie::BOOLEAN);
+  EXPECT_TRUE(flag.parse("false", v));
+  EXPECT_FALSE(v.boolean);
+  EXPECT_FALSE(flag.parse("on", v));
+}
+
+TEST_F(WritablePropertyTest, InvalidCommandsAreRejected) {
+  p->setFormat("0:100");
+  std::vector<int64_t> typed;
+  p->setTypedWriter(
+      [&typed](const homie::CommandValue &v) { typed.push_back(v.integer); });
+  d->onMessage(Msg(p->getSubTopic(), "55"));
+  d->onMessage(Msg(p->getSubTopic(), "101"));
+  d->onMessage(Msg(p->getSubTopic(), "fifty"));
+  EXPECT_EQ(std::vector<int64_t>({55}), typed);
+  EXPECT_EQ("55", p->getValue());
+  EXPECT_EQ(2, p->getRejectedCommands());
+  EXPECT_TRUE(capture.empty()) << "The typed writer replaced the plain one";
+
+  auto readOnly = new homie::Property(n, "ro", "RO", homie::INTEGER, false,
+                                      []() { return "1"; });
+  EXPECT_FALSE(readOnly->command("5"));
+  EXPECT_EQ("", readOnly->getValue());
+  EXPECT_EQ(0, readOnly->getRejectedCommands());
+}
+
+TEST_F(WritablePropertyTest, CommandPolicyPacesWriter) {
+  auto cmd = [this](const char *v) {
+    d->onMessage(Msg(p->getSubTopic(), v));
+  };
+  // minimum interval: the first command goes through, the latest of the
+  // rest follows once the interval is up
+  p->setCommandPolicy(homie::CommandPolicy(100));
+  d->tick(1000);
+  cmd("1");
+  cmd("2");
+  cmd("3");
+  EXPECT_EQ(std::list<std::string>({"1"}), capture);
+  d->tick(1050);
+  EXPECT_EQ(1, capture.size());
+  d->tick(1100);
+  EXPECT_EQ(std::list<std::string>({"1", "3"}), capture);
+  EXPECT_EQ(1, p->getCoalescedCommands());
+  EXPECT_EQ(0, d->pollCommands(1200));
+
+  // debounce: written once the commands stop for 50 ms
+  capture.clear();
+  p->setCommandPolicy(homie::CommandPolicy(0, 50));
+  for (unsigned long t = 2000; t < 2100; t += 20) {
+    d->tick(t);
+    cmd(std::to_string(t).c_str());
+  }
+  EXPECT_TRUE(capture.empty());
+  d->tick(2120);
+  EXPECT_TRUE(capture.empty());
+  d->tick(2130);
+  EXPECT_EQ(std::list<std::string>({"2080"}), capture);
+  EXPECT_EQ("2080", p->getValue());
+  EXPECT_EQ(4, p->getCoalescedCommands());
+
+  // token bucket: 2 per second with a burst of 2, the rest wait their turn
+  capture.clear();
+  p->setCommandPolicy(homie::CommandPolicy(0, 0, 2, 2));
+  d->tick(3000);
+  for (int i = 0; i < 5; i++) {
+    cmd(std::to_string(i).c_str());
+  }
+  EXPECT_EQ(std::list<std::string>({"0", "1"}), capture);
+  EXPECT_EQ(2, p->getDroppedCommands());
+  d->tick(3499);
+  EXPECT_EQ(2, capture.size());
+  d->tick(3500);
+  EXPECT_EQ("4", capture.back());
+  cmd("5");
+  EXPECT_EQ(3, capture.size());
+  d->tick(4000);
+  EXPECT_EQ("5", capture.back());
+
+  p->setCommandPolicy(homie::CommandPolicy());
+  cmd("6");
+  cmd("7");
+  EXPECT_EQ(6, capture.size()) << "No policy, no limits";
+  EXPECT_EQ(0, p->getDroppedCommands());
+}
+
+TEST_F(WritablePropertyTest, CommandFloodKeepsLastPayload) {
+  // debounce 50 ms and at most one write per second
+  p->setCommandPolicy(homie::CommandPolicy(0, 50, 1, 1));
+  auto flood = [this](unsigned long from, int n) {
+    for (int i = 0; i < n; i++) {
+      d->tick(from + i * 10);
+      d->onMessage(Msg(p->getSubTopic(), std::to_string(from + i)));
+    }
+  };
+  flood(5000, 20);
+  d->tick(5240);
+  EXPECT_EQ(std::list<std::string>({"5019"}), capture);
+  // the debounce ends with the bucket still empty: the command must wait
+  // for the next token, not vanish
+  flood(6000, 5);
+  d->tick(6090);
+  EXPECT_EQ(1, capture.size());
+  EXPECT_EQ(1, d->pollCommands(6100)) << "Still pending";
+  d->tick(6240);
+  EXPECT_EQ(std::list<std::string>({"5019", "6004"}), capture);
+  EXPECT_EQ("6004", p->getValue());
+  EXPECT_EQ(0, p->getDroppedCommands());
+}
+
+TEST(HomieSuite, ArenaAllocatesAligned) {
+  homie::Arena a(64);
+  auto p1 = a.allocate(3, 1);
+  auto p2 = a.allocate(8, 8);
+  EXPECT_TRUE(a.owns(p1));
+  EXPECT_EQ(0, (uintptr_t)p2 % 8);
+  EXPECT_EQ(16, a.getUsed());
+  EXPECT_EQ(nullptr, a.allocate(64, 1));
+  EXPECT_EQ(1, a.getOverflows());
+  EXPECT_EQ(2, a.getAllocations());
+}
+
+TEST(HomieSuite, DeviceArenaHoldsTree) {
+  auto d = new TestDevice(4096);
+  ASSERT_NE(nullptr, d->getArena());
+  auto used = d->getArena()->getUsed();
+  EXPECT_GT(used, 0) << "The wifi node lives in the arena";
+  auto n = d->create<homie::Node>(d, "node1", "Node1", "generic");
+  auto p = d->create<homie::Property>(n, "prop1", "Prop1", homie::INTEGER,
+                                      false, []() { return "1"; });
+  auto t = d->create<homie::TypedProperty<float>>(n, "temp", "Temp");
+  EXPECT_TRUE(d->getArena()->owns(n));
+  EXPECT_TRUE(d->getArena()->owns(p));
+  EXPECT_TRUE(d->getArena()->owns(t));
+  EXPECT_EQ(used + sizeof(homie::Node) + sizeof(homie::Property) +
+                sizeof(homie::TypedProperty<float>),
+            d->getArena()->getUsed());
+  // mixing in a heap-allocated property is fine too
+  new homie::Property(n, "prop2", "Prop2", homie::INTEGER, false,
+                      []() { return "2"; });
+  d->introduce();
+  auto value =
+      std::find_if(d->publications.begin(), d->publications.end(),
+                   [p](Msg m) { return m.topic == p->getPubTopic(); });
+  EXPECT_EQ("1", value->payload);
+  delete d;
+}
+
+TEST(HomieSuite, DeviceArenaOverflowsToHeap) {
+  auto d = new TestDevice(sizeof(homie::Node));
+  EXPECT_GT(d->getArena()->getOverflows(), 0);
+  auto n = d->create<homie::Node>(d, "node1", "Node1", "generic");
+  EXPECT_FALSE(d->getArena()->owns(n));
+  delete d;
+}
+
+TEST(HomieSuite, HeapBytes) {
+  std::string small("abc");
+  std::string big(100, 'x');
+  EXPECT_EQ(0, homie::heapBytes(small));
+  EXPECT_GE(homie::heapBytes(big), 101);
+}
+
+TEST_F(PropertyTest, MemoryReportPerNode) {
+  auto before = d->memoryReport();
+  ASSERT_EQ(2, before.nodes.size());
+  auto node1 = std::find_if(
+      before.nodes.begin(), before.nodes.end(),
+      [](const homie::NodeMemory &nm) { return nm.id == "node1"; });
+  ASSERT_NE(before.nodes.end(), node1);
+  EXPECT_EQ(1, node1->propertyCount);
+  EXPECT_GE(node1->usage.total(),
+            sizeof(homie::Node) + sizeof(homie::Property));
+  size_t sum = before.device.total();
+  for (auto &nm : before.nodes) {
+    sum += nm.usage.total();
+  }
+  EXPECT_EQ(sum, before.total.total());
+
+  p->setFormat(std::string(200, 'x'));
+  auto after = d->memoryReport();
+  EXPECT_GE(after.sharedStrings.strings, before.sharedStrings.strings + 200)
+      << "Long strings are counted by capacity";
+  EXPECT_EQ(before.total.strings, after.total.strings)
+      << "Interned strings are reported once, apart from every device";
+}
+
+TEST(HomieSuite, PropertyValueRoundTrips) {
+  homie::PropertyValue v;
+  EXPECT_TRUE(v.empty());
+  EXPECT_EQ("", v.str());
+  struct {
+    const char *text;
+    homie::PropertyValue::Kind kind;
+  } cases[] = {
+      {"42", homie::PropertyValue::INT},
+      {"-9000000000", homie::PropertyValue::INT},
+      {"21.50", homie::PropertyValue::FLOAT},
+      {"0.05", homie::PropertyValue::FLOAT},
+      {"-12.340", homie::PropertyValue::FLOAT},
+      {"0", homie::PropertyValue::INT},
+      {"true", homie::PropertyValue::BOOL},
+      {"007", homie::PropertyValue::SHORT},
+      {"1e5", homie::PropertyValue::SHORT},
+      {"-0", homie::PropertyValue::SHORT},
+      {"medium", homie::PropertyValue::SHORT},
+      {"3.14159265358979323846", homie::PropertyValue::LONG},
+      {"a value too long to inline", homie::PropertyValue::LONG},
+  };
+  for (auto &c : cases) {
+    v.assign(c.text);
+    EXPECT_EQ(c.kind, v.getKind()) << c.text;
+    EXPECT_EQ(c.text, v.str());
+    EXPECT_TRUE(v.equals(c.text));
+    char buf[homie::PropertyValue::RENDER];
+    size_t len;
+    const char *view = v.view(buf, len);
+    EXPECT_EQ(c.text, std::string(view, len));
+    homie::PropertyValue copy(v);
+    EXPECT_EQ(c.text, copy.str());
+  }
+  EXPECT_EQ(strlen(cases[12].text), v.heapBytes());
+  double d;
+  v.assign("21.50");
+  EXPECT_TRUE(v.toDouble(d));
+  EXPECT_DOUBLE_EQ(21.5, d);
+  v.assign("21.5C");
+  EXPECT_TRUE(v.toDouble(d));
+  EXPECT_DOUBLE_EQ(21.5, d);
+  EXPECT_FALSE(v.equals("21.5"));
+}
+
+TEST_F(PropertyTest, PropertyFootprint) {
+  // regression bound for 64-bit hosts; 32-bit targets come out smaller
+  EXPECT_LE(sizeof(homie::PropertyValue), 16);
+  EXPECT_LE(sizeof(homie::Property), 200);
+  auto q = new homie::Property(n, "prop2", "Prop1", homie::FLOAT, false,
+                               []() { return "21.50"; });
+  q->setUnit("°C");
+  p->setUnit("°C");
+  EXPECT_EQ(&p->getFormat(), &q->getFormat());
+  q->publish();
+  EXPECT_EQ("21.50", q->getValue());
+  homie::MemoryUsage u = q->memoryUsage();
+  EXPECT_EQ(0, u.strings) << "Short values and interned attributes";
+  EXPECT_EQ(sizeof(homie::Property), u.total());
+  EXPECT_EQ("homie/testdevice/node1/prop2", q->getPubTopic());
+  EXPECT_EQ("homie/testdevice/node1/prop2/set", q->getSubTopic());
+}
+
+TEST_F(PropertyTest, MemoryNodePublishesReport) {
+  d->enableMemoryNode();
+  d->publishMemory();
+  auto total = std::find_if(
+      d->publications.begin(), d->publications.end(),
+      [](Msg m) { return m.topic == "homie/testdevice/memory/total"; });
+  ASSERT_NE(d->publications.end(), total);
+  EXPECT_GT(std::stoi(total->payload), 0);
+  auto nodes = std::find_if(
+      d->publications.begin(), d->publications.end(),
+      [](Msg m) { return m.topic == "homie/testdevice/memory/nodes"; });
+  ASSERT_NE(d->publications.end(), nodes);
+  EXPECT_NE(std::string::npos, nodes->payload.find("node1="));
+  EXPECT_NE(std::string::npos, nodes->payload.find("memory="));
+}
+
+TEST(HomieSuite, Log2Histogram) {
+  homie::Log2Histogram h;
+  EXPECT_EQ(0, h.percentile(50));
+  h.record(0);
+  h.record(1);
+  h.record(5);
+  h.record(1000);
+  EXPECT_EQ(1, h.getBucket(0));
+  EXPECT_EQ(1, h.getBucket(1));
+  EXPECT_EQ(1, h.getBucket(3)) << "5 is in [4, 8)";
+  EXPECT_EQ(1, h.getBucket(10)) << "1000 is in [512, 1024)";
+  EXPECT_EQ(4, h.getCount());
+  EXPECT_EQ(1006, h.getSum());
+  EXPECT_EQ(7, h.percentile(75));
+  EXPECT_EQ(1000, h.percentile(99)) << "Capped at the max";
+  h.record(0xffffffff);
+  EXPECT_EQ(1, h.getBucket(32));
+}
+
+/** A TestDevice with a manual clock, advanced by its readers */
+class ClockedDevice : public TestDevice {
+public:
+  std::atomic<uint64_t> micros{0};
+  uint64_t getMicros() override { return micros; }
+};
+
+TEST_F(PropertyTest, ReadStatsWithoutDeviceStats) {
+  p->enableReadStats();
+  p->publish();
+  EXPECT_EQ(1, p->getReadLatency()->getCount());
+  EXPECT_EQ(nullptr, d->getStats());
+}
+
+TEST(HomieSuite, DeviceStatsNode) {
+  ClockedDevice d;
+  auto n = new homie::Node(&d, "node1", "Node1", "generic");
+  auto slow = new homie::Property(n, "slow", "Slow", homie::INTEGER, true,
+                                  [&d]() {
+                                    d.micros += 300;
+                                    return std::string("1");
+                                  });
+  d.enableStatsNode(1000);
+  auto fast = new homie::Property(n, "fast", "Fast", homie::INTEGER, false,
+                                  []() { return std::string("2"); });
+  ASSERT_NE(nullptr, slow->getReadLatency());
+  ASSERT_NE(nullptr, fast->getReadLatency()) << "Added after enabling";
+
+  d.introduce();
+  slow->publish();
+  d.onMessage(Msg(slow->getSubTopic(), "3"));
+  auto stats = d.getStats();
+  EXPECT_EQ(d.publications.size(), stats->published);
+  EXPECT_EQ(1, stats->received);
+  EXPECT_EQ(2, slow->getReadLatency()->getCount());
+  EXPECT_EQ(300, slow->getReadLatency()->getMax());
+  EXPECT_EQ(0, fast->getReadLatency()->getMax());
+  EXPECT_EQ(1, stats->introduceMicros.getCount());
+  EXPECT_GE(stats->introduceMicros.getMax(), 300);
+
+  size_t before = d.publications.size();
+  d.tick(999);
+  EXPECT_EQ(before, d.publications.size());
+  d.tick(1000);
+  std::map<std::string, std::string> published;
+  for (auto &m : d.publications) {
+    published[m.topic] = m.payload;
+  }
+  EXPECT_EQ(std::to_string(before),
+            published["homie/testdevice/stats/published"]);
+  EXPECT_EQ("1", published["homie/testdevice/stats/received"]);
+  EXPECT_EQ(homie::f2s(before), published["homie/testdevice/stats/rate"])
+      << "Messages per second over the first second";
+  EXPECT_EQ("300", published["homie/testdevice/stats/read-p99"]);
+}
+
+class SensorDevice : public homie::Device {
+public:
+  homie::Property *level;
+  std::string lastWrite;
+  SensorDevice(std::string id) : homie::Device(id, "1.0", id) {
+    auto n = new homie::Node(this, "sensor", "Sensor", "generic");
+    level = new homie::Property(n, "level", "Level", homie::INTEGER, true,
+                                []() { return "7"; });
+    level->setWriterFunc([this](std::string s) { lastWrite = s; });
+  }
+};
+
+TEST(HomieSuite, RegistrySharesRoutingAndSink) {
+  std::list<Msg> out;
+  homie::DeviceRegistry reg([&out](const Msg &m) { out.push_back(m); });
+  reg.reserve(3, 30);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(reg.add(new SensorDevice("dev" + std::to_string(i))));
+  }
+  auto dup = new SensorDevice("dev0");
+  EXPECT_FALSE(reg.add(dup)) << "Duplicate ids are rejected";
+  delete dup;
+  EXPECT_EQ(3, reg.size());
+  EXPECT_EQ(3 * 5, reg.routeCount()) << "wifi + sensor props per device";
+
+  auto dev1 = (SensorDevice *)reg.getDevice("dev1");
+  EXPECT_EQ(dev1->level, reg.findRoute("homie/dev1/sensor/level/set"));
+  EXPECT_EQ(dev1->level, dev1->findRoute("homie/dev1/sensor/level/set"));
+  reg.onMessage(Msg("homie/dev1/sensor/level/set", "9"));
+  EXPECT_EQ("9", dev1->lastWrite);
+  EXPECT_EQ("", ((SensorDevice *)reg.getDevice("dev2"))->lastWrite);
+
+  dev1->level->publish();
+  ASSERT_EQ(1, out.size()) << "Device output goes to the shared sink";
+  EXPECT_EQ("homie/dev1/sensor/level", out.back().topic);
+
+  reg.remove("dev2");
+  EXPECT_EQ(2 * 5, reg.routeCount());
+  EXPECT_EQ(nullptr, reg.findRoute("homie/dev2/sensor/level/set"));
+}
+
+TEST(HomieSuite, StringTableReleasesRemovedDevices) {
+  homie::StringTable &table = homie::StringTable::shared();
+  size_t before = table.size();
+  {
+    homie::DeviceRegistry reg([](const Msg &) {});
+    auto dev = new SensorDevice("released");
+    dev->level->setUnit("released units");
+    dev->level->setFormat("0:9999");
+    reg.add(dev);
+    EXPECT_LT(before, table.size());
+    reg.remove("released");
+    EXPECT_EQ(before, table.size()) << "Strings go with the last user";
+  }
+  homie::InternedString a("shared text");
+  homie::InternedString b("shared text");
+  EXPECT_EQ(a.get(), b.get());
+  b = homie::InternedString("other text");
+  EXPECT_EQ(before + 2, table.size());
+}
+
+TEST(HomieSuite, RegistryIntroducesIncrementally) {
+  std::list<Msg> out;
+  homie::DeviceRegistry reg([&out](const Msg &m) { out.push_back(m); });
+  reg.add(new SensorDevice("a"));
+  reg.add(new SensorDevice("b"));
+  EXPECT_TRUE(reg.isIntroducing());
+  EXPECT_EQ(10, reg.introduceSome(10));
+  EXPECT_EQ(10, out.size());
+  while (reg.introduceSome(10) > 0) {
+  }
+  EXPECT_FALSE(reg.isIntroducing());
+  EXPECT_EQ(2, std::count_if(out.begin(), out.end(), [](Msg m) {
+              return m.topic.find("/$state") != std::string::npos &&
+                     m.payload == "ready";
+            }));
+
+  // retained fingerprint comes back through the registry
+  auto fp = std::find_if(out.begin(), out.end(), [](Msg m) {
+    return m.topic == "homie/a/$fingerprint";
+  });
+  ASSERT_NE(out.end(), fp);
+  reg.onMessage(*fp);
+  EXPECT_TRUE(reg.getDevice("a")->isTopologyPublished());
+  EXPECT_FALSE(reg.getDevice("b")->isTopologyPublished());
+}
+
+TEST_F(PropertyTest, BulkReaderSamplesNodeOnce) {
+  auto env = new homie::Node(d, "env", "Environment", "BME280");
+  int transactions = 0, individual = 0, reading = 1;
+  std::vector<homie::Property *> props;
+  for (auto id : {"temperature", "humidity", "pressure"}) {
+    props.push_back(new homie::Property(env, id, id, homie::FLOAT, false,
+                                        [&individual]() {
+                                          individual++;
+                                          return std::string("?");
+                                        }));
+  }
+  env->setBulkReader([&transactions, &reading](homie::Node *node) {
+    transactions++;
+    std::string t = std::to_string(reading);
+    node->getProperty("temperature")->setSample("21." + t);
+    node->getProperty("humidity")->setSample("40." + t);
+    node->getProperty("pressure")->setSample("1013." + t);
+  });
+
+  env->publish();
+  EXPECT_EQ(1, transactions);
+  ASSERT_EQ(3, d->publications.size());
+  for (auto &m : d->publications) {
+    EXPECT_EQ('1', m.payload.back()) << "Values from the same sample";
+  }
+
+  for (auto prop : props) {
+    prop->setSampleInterval(1000);
+  }
+  d->publications.clear();
+  int cycles = 0;
+  for (unsigned long now = 0; now <= 2000; now += 100) {
+    size_t due = d->tick(now);
+    if (due > 0) {
+      EXPECT_EQ(3, due) << "Properties of a bulk node are due together";
+      cycles++;
+    }
+  }
+  EXPECT_GE(cycles, 2);
+  EXPECT_EQ(1 + cycles, transactions) << "One bus transaction per cycle";
+  EXPECT_EQ(0, d->publications.size()) << "Unchanged since env->publish()";
+  EXPECT_EQ(0, individual) << "Per-property readers are bypassed";
+
+  d->publications.clear();
+  reading = 2;
+  env->publishIfChanged(5000);
+  EXPECT_EQ(4, transactions);
+  EXPECT_EQ(3, d->publications.size());
+  EXPECT_EQ(0, env->publishIfChanged(5001)) << "Unchanged sample";
+}
+
+TEST(HomieSuite, SnapshotWriterJson) {
+  std::string buf = "stale";
+  homie::SnapshotWriter w(buf, homie::SNAPSHOT_JSON);
+  w.begin(5);
+  w.field("t", homie::FLOAT, "21.5");
+  w.field("n", homie::INTEGER, "+3");
+  w.field("on", homie::BOOLEAN, "true");
+  w.field("s", homie::STRING, "a\"b\\\n");
+  w.field("p", homie::PERCENT, "inf");
+  w.end();
+  EXPECT_EQ("{\"t\":21.5,\"n\":\"+3\",\"on\":true,"
+            "\"s\":\"a\\\"b\\\\\\u000a\",\"p\":\"inf\"}",
+            buf);
+}
+
+TEST(HomieSuite, SnapshotWriterCbor) {
+  std::string buf;
+  homie::SnapshotWriter w(buf, homie::SNAPSHOT_CBOR);
+  w.begin(4);
+  w.field("a", homie::INTEGER, "-500");
+  w.field("b", homie::BOOLEAN, "false");
+  w.field("c", homie::FLOAT, "1.5");
+  w.field("d", homie::INTEGER, "24");
+  w.end();
+  const unsigned char expect[] = {
+      0xa4,                                           // map(4)
+      0x61, 'a', 0x39, 0x01, 0xf3,                    // "a": -500
+      0x61, 'b', 0xf4,                                // "b": false
+      0x61, 'c', 0xfb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0, // "c": 1.5
+      0x61, 'd', 0x18, 0x18};                         // "d": 24
+  EXPECT_EQ(std::string((const char *)expect, sizeof(expect)), buf);
+}
+
+TEST_F(PropertyTest, NodeSnapshotOnly) {
+  auto env = new homie::Node(d, "env", "Environment", "BME280");
+  std::string temperature = "21.5";
+  new homie::Property(env, "temperature", "Temperature", homie::FLOAT, false,
+                      [&temperature]() { return temperature; });
+  new homie::Property(env, "label", "Label", homie::STRING, false,
+                      []() { return "kitchen"; });
+  env->setSnapshot(homie::SNAPSHOT_ONLY);
+  env->publish();
+  ASSERT_EQ(1, d->publications.size());
+  EXPECT_EQ("homie/testdevice/env/$snapshot", d->publications.back().topic);
+  EXPECT_EQ("{\"label\":\"kitchen\",\"temperature\":21.5}",
+            d->publications.back().payload);
+
+  EXPECT_EQ(0, env->publishIfChanged(1)) << "Nothing changed";
+  temperature = "22";
+  EXPECT_EQ(1, env->publishIfChanged(2));
+  EXPECT_EQ("{\"label\":\"kitchen\",\"temperature\":22}",
+            d->publications.back().payload);
+
+  env->setSnapshot(homie::SNAPSHOT_ALSO);
+  d->publications.clear();
+  env->publish();
+  EXPECT_EQ(3, d->publications.size());
+}
+
+/** Just enough of a broker to parse the PUBLISH frames a client sends */
+class FakeBroker {
+public:
+  std::vector<Msg> received;
+  std::vector<uint16_t> packetIds;
+
+  /** Consume every frame in buf, return false on a malformed stream */
+  bool receive(const char *buf, size_t len) {
+    const unsigned char *p = (const unsigned char *)buf, *end = p + len;
+    while (p < end) {
+      if ((*p >> 4) != 3) {
+        return false;
+      }
+      int qos = (*p >> 1) & 3;
+      bool retained = *p++ & 1;
+      size_t remaining = 0, shift = 0;
+      do {
+        if (p == end || shift > 21) {
+          return false;
+        }
+        remaining |= (size_t)(*p & 0x7f) << shift;
+        shift += 7;
+      } while (*p++ & 0x80);
+      if ((size_t)(end - p) < remaining) {
+        return false;
+      }
+      const unsigned char *frameEnd = p + remaining;
+      size_t topicLen = (p[0] << 8) | p[1];
+      p += 2;
+      std::string topic((const char *)p, topicLen);
+      p += topicLen;
+      uint16_t id = 0;
+      if (qos > 0) {
+        id = (p[0] << 8) | p[1];
+        p += 2;
+      }
+      received.push_back(Msg(topic, std::string((const char *)p, frameEnd - p),
+                             retained, qos));
+      packetIds.push_back(id);
+      p = frameEnd;
+    }
+    return true;
+  }
+};
+
+TEST(HomieSuite, MqttFrameRoundTrip) {
+  homie::MqttEncoder enc;
+  char buf[512];
+  std::string big(200, 'x');
+  homie::MqttBatch batch(enc, buf, sizeof(buf));
+  EXPECT_TRUE(batch.add(Msg("homie/dev/$state", "ready")));
+  EXPECT_TRUE(batch.add(Msg("homie/dev/n/p", big, false, 0)));
+  EXPECT_TRUE(batch.add(Msg("homie/dev/n/q", "", true, 2)));
+  EXPECT_EQ(3, batch.count());
+  EXPECT_EQ(homie::MqttEncoder::frameSize(16, 5, 1) +
+                homie::MqttEncoder::frameSize(13, 200, 0) +
+                homie::MqttEncoder::frameSize(13, 0, 2),
+            batch.size());
+  EXPECT_EQ(0x33, (unsigned char)buf[0]) << "PUBLISH, QoS 1, retained";
+
+  FakeBroker broker;
+  ASSERT_TRUE(broker.receive(batch.data(), batch.size()));
+  ASSERT_EQ(3, broker.received.size());
+  EXPECT_EQ("ready", broker.received[0].payload);
+  EXPECT_EQ(big, broker.received[1].payload);
+  EXPECT_FALSE(broker.received[1].retained);
+  EXPECT_EQ(0, broker.packetIds[1]) << "QoS 0 has no packet id";
+  EXPECT_EQ(1, broker.packetIds[0]);
+  EXPECT_EQ(2, broker.packetIds[2]);
+
+  char small[20];
+  homie::MqttBatch full(enc, small, sizeof(small));
+  EXPECT_FALSE(full.add(Msg("homie/dev/n/p", "too long to fit")));
+  EXPECT_EQ(0, full.size());
+  EXPECT_EQ(3, enc.peekPacketId()) << "No id used up by a failed encode";
+}
+
+TEST(HomieSuite, MqttPacketIdsSkipZero) {
+  homie::MqttEncoder enc;
+  char buf[32];
+  uint16_t id;
+  for (int i = 0; i < 65535; i++) {
+    enc.encode(Msg("t", "v"), buf, sizeof(buf), &id);
+  }
+  EXPECT_EQ(65535, id);
+  enc.encode(Msg("t", "v"), buf, sizeof(buf), &id);
+  EXPECT_EQ(1, id);
+  EXPECT_EQ(0, homie::MqttEncoder::frameSize(70000, 0, 1));
+}
+
+TEST_F(PropertyTest, DevicePublishesMqttFrames) {
+  // what a transport's publish() override would do with the encoder
+  homie::MqttEncoder enc;
+  std::vector<char> wire(4096);
+  homie::MqttBatch batch(enc, wire.data(), wire.size());
+  d->introduce();
+  for (auto &m : d->publications) {
+    ASSERT_TRUE(batch.add(m));
+  }
+  FakeBroker broker;
+  ASSERT_TRUE(broker.receive(batch.data(), batch.size()));
+  ASSERT_EQ(d->publications.size(), broker.received.size());
+  auto it = d->publications.begin();
+  for (auto &m : broker.received) {
+    EXPECT_EQ(it->topic, m.topic);
+    EXPECT_EQ(it->payload, m.payload);
+    EXPECT_EQ(it->retained, m.retained);
+    ++it;
+  }
+}
+
+TEST_F(PropertyTest, DiscoveryRebuildsTreeInAnyOrder) {
+  p->setUnit("W");
+  d->introduce();
+  // a broker retains the last message per topic, in no particular order
+  std::map<std::string, Msg> retained;
+  for (auto &m : d->publications) {
+    retained[m.topic] = m;
+  }
+  std::vector<Msg> replay;
+  for (auto &e : retained) {
+    replay.push_back(e.second);
+  }
+  std::reverse(replay.begin(), replay.end());
+  replay.push_back(Msg("homie/testdevice/node1/prop1/set", "x"));
+  replay.push_back(Msg("other/testdevice/$name", "x"));
+
+  homie::Discovery discovery;
+  size_t applied = 0;
+  for (auto &m : replay) {
+    if (discovery.onMessage(m)) {
+      applied++;
+    }
+    if (m.topic == "homie/testdevice/node1/$type") {
+      EXPECT_FALSE(discovery.getDevice("testdevice")->isComplete())
+          << "node1 is described only after its $name";
+    }
+  }
+  // $fingerprint isn't mirrored, /set and foreign topics are ignored
+  EXPECT_EQ(retained.size() - 1, applied);
+  EXPECT_EQ(3, discovery.getIgnored());
+  ASSERT_EQ(1, discovery.size());
+  auto mirror = discovery.getDevice("testdevice");
+  ASSERT_NE(nullptr, mirror);
+  EXPECT_TRUE(mirror->isComplete());
+  EXPECT_EQ("TestDevice", mirror->name);
+  EXPECT_EQ("ready", mirror->state);
+  EXPECT_EQ("1.0", mirror->fwVersion);
+  EXPECT_EQ(d->getNodes().size(), mirror->nodeIds.size());
+  auto node = mirror->getNode("node1");
+  ASSERT_NE(nullptr, node);
+  EXPECT_EQ("generic", node->type);
+  auto prop = node->getProperty("prop1");
+  ASSERT_NE(nullptr, prop);
+  EXPECT_EQ("integer", prop->datatype);
+  EXPECT_EQ("W", prop->unit);
+  EXPECT_EQ("s1", prop->value);
+  EXPECT_EQ(p->isSettable(), prop->settable);
+
+  discovery.onMessage(Msg("homie/testdevice/node1/prop1", "s2"));
+  EXPECT_EQ("s2", prop->value) << "Mirrors stay put as values change";
+}
+
+TEST(HomieSuite, DiscoveryIgnoresWithoutMirroring) {
+  homie::Discovery discovery;
+  EXPECT_FALSE(discovery.onMessage(Msg("homie/dev/node/prop/set", "1")));
+  EXPECT_FALSE(discovery.onMessage(Msg("homie/dev/node/$snapshot", "{}")));
+  EXPECT_FALSE(discovery.onMessage(Msg("homie/dev/$fingerprint", "ab")));
+  EXPECT_FALSE(discovery.onMessage(Msg("homie/dev/$fw/checksum", "x")));
+  EXPECT_EQ(0, discovery.size()) << "A /set echo creates nothing";
+  EXPECT_EQ(4, discovery.getIgnored());
+
+  EXPECT_TRUE(discovery.onMessage(Msg("homie/dev/$name", "Dev")));
+  EXPECT_FALSE(discovery.onMessage(Msg("homie/dev/node/$unknown", "x")));
+  EXPECT_FALSE(discovery.onMessage(Msg("homie/dev/node/prop/$unknown", "x")));
+  EXPECT_TRUE(discovery.getDevice("dev")->nodes.empty());
+  EXPECT_TRUE(discovery.onMessage(Msg("homie/dev/$fw/version", "1.0")));
+  EXPECT_EQ("1.0", discovery.getDevice("dev")->fwVersion);
+}
+
+TEST(HomieSuite, SubscriptionTrieMatchesWildcards) {
+  homie::SubscriptionTrie trie;
+  std::vector<std::string> hits;
+  auto record = [&hits](const char *name) {
+    return [&hits, name](const Msg &) { hits.push_back(name); };
+  };
+  EXPECT_TRUE(trie.add("homie/+/+/+/set", record("set")));
+  EXPECT_TRUE(trie.add("homie/$broadcast/#", record("broadcast")));
+  EXPECT_TRUE(trie.add("app/#", record("app")));
+  EXPECT_TRUE(trie.add("#", record("all")));
+  EXPECT_FALSE(trie.add("a/b#", record("bad")));
+  EXPECT_FALSE(trie.add("a/#/b", record("bad")));
+  EXPECT_FALSE(trie.add("a/+b", record("bad")));
+
+  EXPECT_EQ(2, trie.dispatch(Msg("homie/dev/node/prop/set", "1")));
+  EXPECT_EQ(0, trie.dispatch(Msg("$SYS/uptime", "1")))
+      << "Leading wildcards skip $ topics";
+  EXPECT_EQ(2, trie.dispatch(Msg("homie/$broadcast/alert", "1")));
+  EXPECT_EQ(2, trie.dispatch(Msg("app", "1"))) << "app/# matches app";
+  EXPECT_EQ(1, trie.dispatch(Msg("homie/dev/node/prop", "1")));
+  std::vector<std::string> expect = {"set", "all", "broadcast", "all",
+                                     "app", "all", "all"};
+  std::sort(hits.begin(), hits.end());
+  std::sort(expect.begin(), expect.end());
+  EXPECT_EQ(expect, hits);
+
+  EXPECT_TRUE(trie.remove("#"));
+  EXPECT_FALSE(trie.remove("#"));
+  EXPECT_EQ(0, trie.dispatch(Msg("homie/dev/node/prop", "1")));
+}
+
+TEST(HomieSuite, SubscriptionTrieMinimalFilters) {
+  EXPECT_TRUE(homie::SubscriptionTrie::covers("a/#", "a"));
+  EXPECT_TRUE(homie::SubscriptionTrie::covers("a/+/c", "a/b/c"));
+  EXPECT_FALSE(homie::SubscriptionTrie::covers("a/+/c", "a/#"));
+  EXPECT_FALSE(homie::SubscriptionTrie::covers("+/x", "$SYS/x"));
+
+  homie::SubscriptionTrie trie;
+  auto none = [](const Msg &) {};
+  for (auto f : {"homie/dev/+/+/set", "homie/dev/node/prop/set",
+                 "homie/dev/$fingerprint", "homie/#", "app/+/x", "app/y/x"}) {
+    trie.add(f, none);
+  }
+  std::vector<std::string> expect = {"app/+/x", "homie/#"};
+  EXPECT_EQ(expect, trie.minimalFilters());
+}
+
+TEST_F(WritablePropertyTest, DeviceSubscriptions) {
+  std::vector<std::string> broadcasts;
+  d->onBroadcast(
+      [&broadcasts](const Msg &m) { broadcasts.push_back(m.payload); });
+  d->onMessage(Msg("homie/$broadcast/alert", "fire"));
+  d->onMessage(Msg(p->getSubTopic(), "7"));
+  EXPECT_EQ(std::vector<std::string>({"fire"}), broadcasts);
+  EXPECT_EQ("7", p->getValue()) << "Commands are still routed";
+
+  std::vector<std::string> expect = {"homie/$broadcast/#",
+                                     "homie/testdevice/$fingerprint",
+                                     "homie/testdevice/+/+/set"};
+  EXPECT_EQ(expect, d->getSubscriptionFilters());
+  d->addSubscription("homie/testdevice/#", [](const Msg &) {});
+  EXPECT_EQ(2, d->getSubscriptionFilters().size());
+}
+
+#ifdef HOMIE_MMAP
+TEST_F(WritablePropertyTest, RecordAndReplay) {
+  std::string path = testing::TempDir() + "homie-record.log";
+  homie::MessageLog log;
+  ASSERT_TRUE(log.open(path));
+  d->setRecorder(&log);
+  d->introduce();
+  d->onMessage(Msg(p->getSubTopic(), "1"));
+  d->setRecorder(nullptr);
+  size_t published = d->publications.size();
+  // a long payload forces the mapping to grow
+  std::string big(100000, 'x');
+  ASSERT_TRUE(log.append(5000, homie::LOG_PUBLISHED, Msg("big", big, false)));
+  log.close();
+
+  homie::MessageLogReader reader;
+  ASSERT_TRUE(reader.open(path));
+  homie::LogRecord r;
+  auto it = d->publications.begin();
+  for (size_t i = 0; i < published; i++, ++it) {
+    ASSERT_TRUE(reader.next(r));
+    EXPECT_EQ(homie::LOG_PUBLISHED, r.direction);
+    EXPECT_EQ(it->topic, r.message.topic);
+    EXPECT_EQ(it->payload, r.message.payload);
+    EXPECT_EQ(it->retained, r.message.retained);
+  }
+  ASSERT_TRUE(reader.next(r));
+  EXPECT_EQ(homie::LOG_RECEIVED, r.direction);
+  EXPECT_EQ("1", r.message.payload);
+  ASSERT_TRUE(reader.next(r));
+  EXPECT_EQ(5000, r.time);
+  EXPECT_EQ(big, r.message.payload);
+  EXPECT_FALSE(r.message.retained);
+  EXPECT_FALSE(reader.next(r));
+
+  // replaying applies the recorded command again
+  reader.rewind();
+  p->setValue("0");
+  size_t sunk = 0;
+  EXPECT_EQ(published + 2,
+            reader.replay(*d, [&sunk](const Msg &) { sunk++; }));
+  EXPECT_EQ(published + 1, sunk);
+  EXPECT_EQ("1", p->getValue());
+  std::remove(path.c_str());
+}
+
+static std::string readFile(const std::string &path) {
+  std::string s;
+  FILE *f = fopen(path.c_str(), "rb");
+  char buf[4096];
+  size_t n;
+  while (f && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    s.append(buf, n);
+  }
+  if (f) {
+    fclose(f);
+  }
+  return s;
+}
+
+TEST(HomieSuite, MessageLogStopsAtTornRecord) {
+  std::string path = testing::TempDir() + "homie-torn.log";
+  homie::MessageLog log;
+  ASSERT_TRUE(log.open(path));
+  ASSERT_TRUE(log.append(1, homie::LOG_PUBLISHED, Msg("a/b", "complete")));
+  log.close();
+  size_t first = readFile(path).size();
+  ASSERT_TRUE(log.open(path));
+  ASSERT_TRUE(log.append(1, homie::LOG_PUBLISHED, Msg("a/b", "complete")));
+  ASSERT_TRUE(log.append(2, homie::LOG_RECEIVED, Msg("c/d", "torn payload")));
+  log.close();
+  std::string bytes = readFile(path);
+
+  // what a crash half way through the second append leaves: part of its
+  // body, no flags byte yet, and the zeroed tail of the mapping
+  std::string torn = bytes.substr(0, first) + '\0' +
+                     bytes.substr(first + 1, (bytes.size() - first) / 2) +
+                     std::string(64, '\0');
+  FILE *f = fopen(path.c_str(), "wb");
+  ASSERT_NE(nullptr, f);
+  fwrite(torn.data(), 1, torn.size(), f);
+  fclose(f);
+
+  homie::MessageLogReader reader;
+  ASSERT_TRUE(reader.open(path));
+  homie::LogRecord r;
+  ASSERT_TRUE(reader.next(r));
+  EXPECT_EQ("complete", r.message.payload);
+  EXPECT_FALSE(reader.next(r)) << "The torn record is not returned";
+  reader.close();
+  std::remove(path.c_str());
+}
+#endif
+
+#if __cplusplus >= 201703L
+namespace schema = homie::schema;
+static constexpr auto staticDevice = schema::device(
+    "homie", "testdevice", "TestDevice", "1.0",
+    schema::node("node1", "Node1", "generic",
+                 schema::property("prop1", "Prop1", homie::INTEGER)
+                     .settable()
+                     .unit("W")
+                     .format("0:100")),
+    schema::node(
+        "wifi", "WiFi", "WIFI",
+        schema::property("localip", "Local IP", homie::STRING),
+        schema::property("mac", "MAC Address", homie::STRING),
+        schema::property("rssi", "RSSI", homie::INTEGER),
+        schema::property("signal", "Wifi Signal", homie::INTEGER)));
+static constexpr auto staticIntro = schema::introduction<staticDevice>();
+static constexpr auto staticTopics = schema::propertyTopics<staticDevice>();
+
+static_assert(staticIntro.topic(0) == "homie/testdevice/$homie",
+              "Topics are generated at compile time");
+static_assert(staticTopics.payload(0) == "homie/testdevice/node1/prop1/set",
+              "Command topics too");
+
+TEST_F(WritablePropertyTest, StaticSchemaMatchesRuntimeIntroduction) {
+  p->setUnit("W");
+  p->setFormat("0:100");
+  d->introduce();
+  std::map<std::string, std::string> runtime;
+  for (auto &m : d->publications) {
+    runtime[m.topic] = m.payload;
+  }
+  // the runtime device also carries the test extension
+  runtime["homie/testdevice/$extensions"] = homie::LEGACY_FIRMWARE_EXTENSION;
+  for (size_t i = 0; i < staticIntro.size(); i++) {
+    std::string topic(staticIntro.topic(i));
+    ASSERT_EQ(1, runtime.count(topic)) << topic;
+    EXPECT_EQ(runtime[topic], std::string(staticIntro.payload(i))) << topic;
+  }
+  EXPECT_EQ(5, staticTopics.size());
+  EXPECT_EQ(p->getPubTopic(), std::string(staticTopics.topic(0)));
+  EXPECT_EQ(3, staticTopics.find("homie/testdevice/wifi/rssi"));
+  EXPECT_EQ("homie/testdevice/$name", staticIntro.message(1).topic);
+}
+
+static constexpr auto typesDevice = schema::device(
+    "homie", "testdevice", "TestDevice", "1.0",
+    schema::node("types", "Types", "generic",
+                 schema::property("p0", "P0", homie::INTEGER),
+                 schema::property("p1", "P1", homie::STRING),
+                 schema::property("p2", "P2", homie::FLOAT),
+                 schema::property("p3", "P3", homie::PERCENT),
+                 schema::property("p4", "P4", homie::BOOLEAN),
+                 schema::property("p5", "P5", homie::ENUM),
+                 schema::property("p6", "P6", homie::COLOR),
+                 schema::property("p7", "P7", homie::DATETIME),
+                 schema::property("p8", "P8", homie::DURATION)));
+static constexpr auto typesIntro = schema::introduction<typesDevice>();
+
+TEST_F(PropertyTest, StaticSchemaMatchesRuntimeDataTypes) {
+  auto types = new homie::Node(d, "types", "Types", "generic");
+  for (int t = homie::INTEGER; t <= homie::DURATION; t++) {
+    std::string id = "p" + std::to_string(t);
+    std::string name = "P" + std::to_string(t);
+    new homie::Property(types, id, name, (homie::DataType)t, false,
+                        []() { return std::string(); });
+  }
+  homie::Introduction intro(d);
+  std::map<std::string, std::string> runtime;
+  Msg m;
+  while (intro.next(m)) {
+    runtime[m.topic] = m.payload;
+  }
+  size_t compared = 0;
+  for (size_t i = 0; i < typesIntro.size(); i++) {
+    std::string topic(typesIntro.topic(i));
+    if (topic.find("/types/") == std::string::npos &&
+        topic.find("/$homie") == std::string::npos &&
+        topic.find("/$implementation") == std::string::npos) {
+      continue;
+    }
+    ASSERT_EQ(1, runtime.count(topic)) << topic;
+    EXPECT_EQ(runtime[topic], std::string(typesIntro.payload(i))) << topic;
+    compared++;
+  }
+  EXPECT_EQ(2 + 3 + 9 * 3, compared);
+}
+#endif
+
+TEST(HomieSuite, MpscRingFifoAndFull) {
+  homie::MpscRing<int> ring(3);
+  EXPECT_EQ(4, ring.capacity()) << "Rounded up to a power of two";
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(ring.push(i));
+  }
+  EXPECT_FALSE(ring.push(4));
+  EXPECT_EQ(1, ring.getDropped());
+  int v;
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(ring.pop(v));
+    EXPECT_EQ(i, v);
+  }
+  EXPECT_FALSE(ring.pop(v));
+  EXPECT_TRUE(ring.push(5)) << "Slots are reused after wrapping";
+  EXPECT_TRUE(ring.pop(v));
+  EXPECT_EQ(5, v);
+}
+
+#ifdef HOMIE_THREADS
+TEST(HomieSuite, MpscRingStress) {
+  const int producers = 4, perProducer = 20000;
+  homie::MpscRing<int> ring(256);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < producers; t++) {
+    threads.push_back(std::thread([&ring, t]() {
+      for (int i = 0; i < perProducer; i++) {
+        while (!ring.push(t * perProducer + i)) {
+          std::this_thread::yield();
+        }
+      }
+    }));
+  }
+  std::vector<int> last(producers, -1);
+  int received = 0, v;
+  while (received < producers * perProducer) {
+    if (!ring.pop(v)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int t = v / perProducer, i = v % perProducer;
+    EXPECT_EQ(last[t] + 1, i) << "Per-producer order must be kept";
+    last[t] = i;
+    received++;
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+  EXPECT_FALSE(ring.pop(v));
+}
+
+TEST_F(WritablePropertyTest, ConcurrentPublishStress) {
+  const int producers = 4, perProducer = 2000;
+  d->enableConcurrentSend(producers * perProducer);
+  // read times are recorded from the publishing threads
+  d->enableStats();
+  std::vector<homie::Property *> props;
+  std::vector<int> counters(producers, 0);
+  for (int t = 0; t < producers; t++) {
+    int *counter = &counters[t];
+    props.push_back(new homie::Property(
+        n, "sensor" + std::to_string(t), "Sensor", homie::INTEGER, false,
+        [counter]() { return std::to_string((*counter)++); }));
+  }
+  std::vector<std::thread> threads;
+  for (int t = 0; t < producers; t++) {
+    auto prop = props[t];
+    threads.push_back(std::thread([prop]() {
+      for (int i = 0; i < perProducer; i++) {
+        prop->publish();
+      }
+    }));
+  }
+  // the network thread ticks (which drains) and dispatches commands
+  // concurrently
+  auto cmd = Msg(p->getSubTopic(), "1");
+  const size_t total = producers * perProducer;
+  unsigned long now = 0;
+  while (d->publications.size() < total) {
+    d->tick(now++);
+    d->onMessage(cmd);
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+  EXPECT_EQ(0, d->drain());
+  EXPECT_EQ(total, d->publications.size());
+  EXPECT_EQ(0, d->getConcurrentOutbox()->getDropped());
+  EXPECT_EQ((uint32_t)total, d->getStats()->readMicros.getCount());
+  for (int t = 0; t < producers; t++) {
+    auto topic = props[t]->getPubTopic();
+    int expect = 0;
+    for (auto &m : d->publications) {
+      if (m.topic == topic) {
+        EXPECT_EQ(std::to_string(expect++), m.payload);
+      }
+    }
+    EXPECT_EQ(perProducer, expect);
+  }
+  EXPECT_EQ("1", p->getValue());
+}
+
+TEST_F(PropertyTest, AsyncReaderDoesNotBlock) {
+  std::atomic<bool> release(false);
+  auto slow = new homie::Property(n, "slow", "Slow", homie::INTEGER, false,
+                                  [&release]() {
+                                    while (!release) {
+                                      std::this_thread::yield();
+                                    }
+                                    return std::string("42");
+                                  });
+  homie::WorkerPool pool(1);
+  slow->setAsyncReader(pool, 1000);
+  slow->publish();
+  d->introduce();
+  auto valueMsgs = [this, slow]() {
+    return std::count_if(
+        d->publications.begin(), d->publications.end(),
+        [slow](const Msg &m) { return m.topic == slow->getPubTopic(); });
+  };
+  EXPECT_EQ(0, valueMsgs()) << "Nothing cached, so nothing published yet";
+  EXPECT_EQ(1, d->pollReads(0)) << "Still reading";
+  release = true;
+  while (d->pollReads(10) > 0) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(1, valueMsgs());
+  EXPECT_EQ("42", d->publications.back().payload);
+  EXPECT_EQ("42", slow->getValue());
+}
+
+TEST_F(PropertyTest, AsyncReadsPublishInOrder) {
+  std::vector<std::function<void(std::string)>> pending;
+  p->setAsyncReader(
+      [&pending](std::function<void(std::string)> done) {
+        pending.push_back(done);
+      },
+      1000);
+  p->publishIfChanged(0);
+  p->publishIfChanged(1);
+  ASSERT_EQ(1, pending.size()) << "One outstanding read per property";
+  d->tick(2);
+  EXPECT_EQ(0, d->publications.size());
+  pending[0]("1");
+  d->tick(3);
+  p->publishIfChanged(4);
+  ASSERT_EQ(2, pending.size());
+  pending[1]("2");
+  d->tick(5);
+  ASSERT_EQ(2, d->publications.size());
+  EXPECT_EQ("1", d->publications.front().payload);
+  EXPECT_EQ("2", d->publications.back().payload);
+}
+
+TEST_F(PropertyTest, AsyncReadTimesOut) {
+  std::vector<std::function<void(std::string)>> pending;
+  p->setAsyncReader(
+      [&pending](std::function<void(std::string)> done) {
+        pending.push_back(done);
+      },
+      200);
+  p->setValue("cached");
+  p->publishIfChanged(0);
+  d->tick(199);
+  EXPECT_EQ(0, p->getReadTimeouts());
+  d->tick(200);
+  EXPECT_EQ(1, p->getReadTimeouts());
+  ASSERT_EQ(1, d->publications.size()) << "Falls back to the cached value";
+  EXPECT_EQ("cached", d->publications.back().payload);
+
+  p->publishIfChanged(300);
+  EXPECT_EQ(1, pending.size()) << "Waits for the late read, not a new one";
+  pending[0]("late");
+  d->tick(301);
+  EXPECT_EQ("late", d->publications.back().payload);
+
+  auto fresh = new homie::Property(n, "fresh", "Fresh", homie::INTEGER, false,
+                                   []() { return std::string("1"); });
+  fresh->setAsyncReader([](std::function<void(std::string)>) {}, 100);
+  size_t before = d->publications.size();
+  fresh->publish();
+  d->tick(401);
+  EXPECT_EQ(1, fresh->getReadTimeouts());
+  EXPECT_EQ(before, d->publications.size()) << "No empty fallback";
+}
+
+TEST(HomieSuite, PoolReadsAreTimed) {
+  TestDevice d;
+  d.enableStats();
+  auto n = new homie::Node(&d, "node1", "Node1", "generic");
+  auto slow = new homie::Property(n, "slow", "Slow", homie::INTEGER, false,
+                                  []() {
+                                    std::this_thread::sleep_for(
+                                        std::chrono::milliseconds(2));
+                                    return std::string("1");
+                                  });
+  homie::WorkerPool pool(1);
+  slow->setAsyncReader(pool, 1000);
+  slow->publish();
+  while (d.pollReads(0) > 0) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ("1", slow->getValue());
+  EXPECT_EQ(1, slow->getReadLatency()->getCount());
+  EXPECT_GE(slow->getReadLatency()->getMax(), 2000);
+  EXPECT_EQ(1, d.getStats()->readMicros.getCount());
+}
+#endif